@@ -0,0 +1,109 @@
+#!/bin/bash
+
+# usage: bench/run.sh [--json] [vm...] (default ./vm)
+# runs every benchmark a few times with every vm given, and prints the best
+# wall clock time of each. extra flags go in VMFLAGS, e.g. VMFLAGS=--no-jit
+# to time the interpreter alone.
+# a benchmark foo.bin reads the output of foo.input through a pipe, if there
+# is one, and nothing otherwise.
+#
+# with --json, it prints a result per benchmark and vm instead (see make
+# bench), one per line so that two of them diff well:
+#   instructions        executed, counted once with the profiling build
+#                       (PROFILE_VM, default ./vm-profile) and no fusion
+#   best_ns, median_ns  wall clock time of the runs, the vm started included
+#   ns_per_instruction  and instructions_per_s, from the best run
+#   gc_ns               marking, copying and sweeping, from one more run with
+#                       --gc-stats-json, which also gives
+#   peak_rss_bytes      the largest the vm's resident set got
+# the counts are null where the profiling build (or a vm that knows about
+# --gc-stats-json) is missing.
+#
+# the benchmarks:
+#   arith-loop     arithmetic and comparisons in a counted loop
+#   stack-shuffle  DUP and SWAP deep into a stack of 32 entries
+#   list-walk      building lists with CONS and walking them with HD and TL
+#   gc-churn       lists that live just long enough to be promoted, next to
+#                  one that lives for the whole run
+#   big-heap       a million cells that stay alive, a thousand lists of a
+#                  thousand, and short lived ones next to them (see make
+#                  bench-gc-threads)
+#   cat            echoing 16M of input to the output
+json=
+if [ "$1" = --json ]; then
+    json=1
+    shift
+fi
+runs=${RUNS:-5}
+profile_vm=${PROFILE_VM:-./vm-profile}
+vms=("$@")
+[ ${#vms[@]} -eq 0 ] && vms=(./vm)
+dir=$(dirname $0)
+
+input=$(mktemp)
+stats=$(mktemp)
+trap "rm -f $input $stats" EXIT
+
+# the value of a top level field in the --gc-stats-json output, or nothing
+field() {
+    sed -n "s/^  \"$1\": \([0-9]*\),\$/\1/p" $stats
+}
+
+if [ -n "$json" ]; then
+    printf '{"runs": %d, "flags": "%s", "results": [' $runs "$VMFLAGS"
+else
+    printf "%-20s" benchmark
+    for vm in "${vms[@]}"; do printf "%16s" $(basename $vm); done
+    echo
+fi
+
+separator=
+for bin in $dir/*.bin; do
+    name=$(basename $bin .bin)
+    : > $input
+    [ -x ${bin%.bin}.input ] && ${bin%.bin}.input > $input
+    [ -z "$json" ] && printf "%-20s" $name
+    instructions=
+    if [ -n "$json" ] && [ -x $profile_vm ]; then
+        instructions=$($profile_vm --no-fuse $bin < $input 2>&1 > /dev/null | awk '$1 == "total" { print $2 }')
+    fi
+    for vm in "${vms[@]}"; do
+        times=()
+        for i in $(seq $runs); do
+            start=$(date +%s%N)
+            cat $input | $vm $VMFLAGS $bin > /dev/null
+            times+=($(( $(date +%s%N) - start )))
+        done
+        sorted=($(printf "%s\n" "${times[@]}" | sort -n))
+        best=${sorted[0]}
+        median=${sorted[$(( runs / 2 ))]}
+        if [ -z "$json" ]; then
+            printf "%14sms" $(( best / 1000000 ))
+            continue
+        fi
+        : > $stats
+        $vm $VMFLAGS --gc-stats-json $stats $bin < $input > /dev/null 2>&1
+        gc=
+        if [ -s $stats ]; then
+            mark=$(field mark_ns) sweep=$(field sweep_ns) lazy=$(field lazy_sweep_ns)
+            gc=$(( ${mark:-0} + ${sweep:-0} + ${lazy:-0} ))
+        fi
+        rss=$(field peak_rss_bytes)
+        awk -v sep="$separator" -v vm="$vm" -v name=$name -v n="$instructions" \
+            -v best=$best -v median=$median -v gc="$gc" -v rss="$rss" '
+            function or_null(x) { return x == "" ? "null" : x }
+            BEGIN {
+                printf "%s\n  {\"vm\": \"%s\", \"benchmark\": \"%s\", \"instructions\": %s, ", sep, vm, name, or_null(n)
+                printf "\"best_ns\": %d, \"median_ns\": %d, ", best, median
+                if (n == "")
+                    printf "\"ns_per_instruction\": null, \"instructions_per_s\": null, "
+                else
+                    printf "\"ns_per_instruction\": %.3f, \"instructions_per_s\": %.0f, ", best / n, n / (best / 1e9)
+                printf "\"gc_ns\": %s, \"peak_rss_bytes\": %s}", or_null(gc), or_null(rss)
+            }'
+        separator=,
+    done
+    [ -z "$json" ] && echo
+done
+[ -n "$json" ] && echo && echo "]}"
+exit 0
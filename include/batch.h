@@ -0,0 +1,30 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "vm.h"
+
+/*
+ * Batch mode (--batch): many small jobs in a single process, instead of a
+ * ./vm per job. The manifest has a job per line,
+ *
+ *     program input output
+ *
+ * separated by blanks, where input and output may be "-" (or left out) for
+ * no input and for throwing the output away. Empty lines and lines starting
+ * with # are skipped.
+ *
+ * Every program is loaded once, and shared by all the workers. Each worker
+ * is a thread with a VM of its own (stack, heap, JIT and I/O buffers) that
+ * it reuses from one job to the next. The jobs are dealt out to the workers
+ * up front, and a worker that is done with its own steals from the others.
+ *
+ * At the end, the throughput and the latency of the jobs go to report.
+ * Returns the number of jobs that failed, or -1 if the manifest could not
+ * be read or there are no workers.
+ */
+int runBatch(const char* manifest, const vm_options* options, size_t workers, FILE* report);
+
+#endif
@@ -1,10 +1,17 @@
 #ifndef BITARRAY_H
 #define BITARRAY_H
 
-#define MARK_FAKE        (0x8000000000000000)
-#define Mark(A,k)        ( A[(k)/32] |= (1 << ((k)%32))  )
-#define Unmark(A,k)      ( A[(k)/32] &= ~(1 << ((k)%32)) )
-#define IsMarked(A,k)    ( A[(k)/32] & (1 << ((k)%32))   )
-#define PointsToHeap(a)  ( (a & (MARK_FAKE)) )
+#include <stdint.h>
 
-#endif
\ No newline at end of file
+/*
+ * One mark bit per cons cell, so k is a cell index (the offset from the
+ * bottom of the region divided by sizeof(cons)), not a byte offset. The
+ * bits are kept in 64 bit words so that the sweep can look at 64 cells at
+ * once.
+ */
+#define BitWords(n)      ( (n) / 64 + ((n) % 64 != 0) )
+#define Mark(A,k)        ( A[(k)/64] |= ((uint64_t)1 << ((k)%64))  )
+#define Unmark(A,k)      ( A[(k)/64] &= ~((uint64_t)1 << ((k)%64)) )
+#define IsMarked(A,k)    ( A[(k)/64] & ((uint64_t)1 << ((k)%64))   )
+
+#endif
@@ -1,12 +1,26 @@
 #ifndef CONS_H
 #define CONS_H
 
+#include <stdint.h>
+
+/*
+ * The head and the tail of a cell are both values. By default they are
+ * stack words as they are. In the compact build (make compact, which
+ * defines VM_COMPACT) they are 32 bit words instead, so that a cell takes 8
+ * bytes and not 16: gc.h packs a stack word into one (see WordOf) and
+ * expands it back (ValueOf) when HD and TL push it.
+ */
+#ifdef VM_COMPACT
+typedef uint32_t cell_word;
+#else
+typedef uintptr_t cell_word;
+#endif
+
 struct _cons_cell
 {
-    uintptr_t head;
-    struct _cons_cell* tail;
+    cell_word head;
+    cell_word tail;
 };
 typedef struct _cons_cell cons;
 
 #endif
-
@@ -0,0 +1,28 @@
+#ifndef DISASM_H
+#define DISASM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Writes the assembly for the instruction at pc (e.g. "PUSH1 2a") into buf,
+ * and returns the size of the instruction in bytes. Returns 0, and leaves
+ * buf empty, if the opcode is not a known one. A superinstruction is shown
+ * as its first part followed by its name (e.g. "DUP 0 [DUP_JNZ]").
+ */
+size_t disassemble(const uint8_t* pc, char* buf, size_t size);
+// the mnemonic alone, or NULL for an unknown opcode
+const char* opcodeName(uint8_t opcode);
+/*
+ * The size of an instruction in bytes, or 0 for an unknown opcode. For a
+ * superinstruction it is the size of its first part, since the other parts
+ * are still there after it.
+ */
+size_t instructionSize(uint8_t opcode);
+// JUMP, JNZ and their wide versions
+bool isJump(uint8_t opcode);
+// the address the jump at pc goes to, whichever width it is
+size_t jumpTarget(const uint8_t* pc);
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef FUSION_H
+#define FUSION_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * A superinstruction replaces a short straight line sequence of
+ * instructions. Only the opcode of the first one is rewritten: the operands
+ * of every part stay where they were, so the handler reads them from the
+ * same offsets and no address in the program has to change.
+ */
+struct superinstruction
+{
+    const char* name;
+    uint8_t opcode;
+    uint8_t length;
+    uint8_t parts[3];
+};
+typedef struct superinstruction superinstruction;
+
+// the superinstruction with this opcode, or NULL
+const superinstruction* superinstructionOf(uint8_t opcode);
+
+/*
+ * Rewrites every sequence in the program that has a superinstruction, as
+ * long as no jump lands inside it. Returns how many were rewritten. Nothing
+ * is touched if a jump lands somewhere that is not an instruction boundary,
+ * since then the program cannot be decoded in a single pass.
+ */
+size_t fuseSuperinstructions(uint8_t* program, size_t length);
+
+#endif
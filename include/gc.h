@@ -1,3 +1,4 @@
+
 #ifndef GC_H
 #define GC_H
 
@@ -10,18 +11,211 @@
 #include "cons.h"
 #include "bitarray.h"
 #include "utils.h"
+#include "value.h"
+#include "gcstats.h"
+#include "gcmark.h"
+#include "gcsweep.h"
+
+/*
+ * A young cell that has been copied to the old generation during a minor
+ * collection keeps the new (marked) address in its head and this value in
+ * its tail. No real value can look like this, since it says "heap address"
+ * but the address itself is not cons aligned.
+ */
+#ifdef VM_COMPACT
+#define FORWARDED        ((cell_word) 2 | 1)
+#else
+#define FORWARDED        ((cell_word) CellValue(2))
+#endif
+
+/*
+ * The old generation is made of one or more separately mapped regions. Each
+ * region has its own bit array, indexed by the cell number from its bottom.
+ * Regions are a whole number of pages, so their cells always fill the last
+ * word of the bit array.
+ */
+struct heap_region
+{
+    uintptr_t bottom;
+    size_t size;
+    uint64_t *bitarray;
+};
+typedef struct heap_region heap_region;
+
+#define MAX_REGIONS      64
+#define LAZY_SWEEP_CHUNK 256
+
+// what gc->collecting says
+#define GC_MINOR 1
+#define GC_MAJOR 2
 
 struct garbage_collector
 {
     stack_t* machine;
-    uint32_t* heap;
+    /* old generation: mark and sweep over a freelist */
+    heap_region regions[MAX_REGIONS];
+    size_t region_count;
     size_t size;
-    uintptr_t bottom;
-    uint32_t *bitarray;
+    size_t max_size;
+    /*
+     * after a major collection, the heap grows if more than this fraction
+     * of it is still alive.
+     */
+    double grow_threshold;
     cons* freelist;
+    /* free cells in the old generation, including the ones not swept yet */
+    size_t free_cells;
+    /*
+     * With lazy sweeping, a major collection only marks. The sweep is then
+     * done LAZY_SWEEP_CHUNK cells at a time, whenever the freelist is empty,
+     * and these remember where it stopped.
+     */
+    bool lazy_sweep;
+    size_t sweep_region;
+    size_t sweep_word;
+    size_t sweep_regions;
+    /* only with --concurrent-sweep, which then sweeps instead, see gcsweep.h */
+    gc_sweeper* sweeper;
+    /*
+     * young generation (nursery): cells are handed out by bumping
+     * young_ptr. When it reaches young_limit, the survivors are copied to
+     * the old generation and the whole nursery is reused.
+     */
+    cons* nursery;
+    cons* young_ptr;
+    cons* young_limit;
+    size_t nursery_size;
+    uint64_t* young_bitarray;
+    /* the worklist of promoted cells, sized once for the whole nursery */
+    cons** promoted;
+    /* only set with --gc-stats */
+    gc_stats* stats;
+    /*
+     * 0, GC_MINOR or GC_MAJOR, for the sampling profiler's signal handler
+     * (see sampler.h), which is why it is volatile. An int is as atomic as
+     * a sig_atomic_t, and signal.h cannot be included next to stack.h.
+     */
+    volatile int collecting;
+    /*
+     * Cells marked but not looked at yet. Every cell is pushed once at
+     * most, so it is as large as the heap and the nursery together, and
+     * it is kept from one collection to the next.
+     */
+    uintptr_t* mark_stack;
+    size_t mark_stack_size;
+    /* only with --gc-threads, see gcmark.h */
+    gc_markers* markers;
+#ifdef VM_PROFILE
+    /* only with --heap-profile, see heapprof.h */
+    struct heap_profile* heap_profile;
+#endif
+    /* old cells that may point into the nursery (see WriteBarrier) */
+    cons** remembered;
+    size_t remembered_count;
+    size_t remembered_size;
+#ifdef VM_COMPACT
+    /*
+     * The regions follow each other from base on, and the nursery comes
+     * after max_size, so that every cell is at a 32 bit offset from base.
+     * What is not mapped yet is reserved, reserved bytes in all.
+     */
+    uintptr_t base;
+    size_t reserved;
+#endif
 };
 typedef struct garbage_collector garbage_collector;
 
+/*
+ * How a value is kept in the head or the tail of a cell (see cons.h).
+ *
+ * In the compact build, a cell word with the low bit set is a heap
+ * reference, the offset of the cell from gc->base with that bit added.
+ * Otherwise it is a signed 31 bit integer, shifted left by one. A value that
+ * is neither cannot be stored in a cell (FitsCell), and CONS stops the
+ * program instead. The freelist links cells through their heads with the
+ * same references, and 0 ends it.
+ */
+#ifdef VM_COMPACT
+#define LinkOf(gc,cell)    ( (cell_word) ((uintptr_t) (cell) - (gc)->base) | 1 )
+#define LinkedCell(gc,w)   ( (cons*) ((gc)->base + (w) - 1) )
+#define FitsCell(v)        ( PointsToHeap(v)                                           \
+                             || (uintptr_t) (ValueInt(v) + (1L << 30)) < (1UL << 31) )
+#define WordOf(gc,v)       ( PointsToHeap(v) ? LinkOf(gc, CellOf(v))                   \
+                                             : (cell_word) ValueInt(v) << 1 )
+#define ValueOf(gc,w)      ( (w) & 1 ? CellValue(LinkedCell(gc, w))                   \
+                                     : IntValue((int32_t) (w) >> 1) )
+#define NextFree(gc,cell)  ( (cell)->head ? LinkedCell(gc, (cell)->head) : NULL )
+#define SetNextFree(gc,cell,next)                                      \
+    ( (cell)->head = (next) ? LinkOf(gc, next) : 0 )
+#else
+#define FitsCell(v)        ( true )
+#define WordOf(gc,v)       ( (cell_word) (v) )
+#define ValueOf(gc,w)      ( (uintptr_t) (w) )
+#define NextFree(gc,cell)  ( (cons*) (cell)->head )
+#define SetNextFree(gc,cell,next)  ( (void) (gc), (cell)->head = (cell_word) (next) )
+#endif
+
+#define InNursery(gc,a)  ( (uintptr_t)(a) - (uintptr_t)(gc)->nursery < (gc)->nursery_size )
+
+/*
+ * Every store of a value into a cell that might already live in the old
+ * generation must go through here, otherwise a minor collection would not
+ * see the young cell as reachable. Stores into freshly bumped nursery cells
+ * fail the first test and cost nothing else.
+ */
+#define WriteBarrier(gc,cell,value)                                         \
+    do {                                                                    \
+        if (!InNursery(gc, cell) && PointsToHeap((uintptr_t)(value))        \
+            && InNursery(gc, CellOf(value)))                                \
+            rememberCell(gc, cell);                                         \
+    } while (0)
+
+/*
+ * Finds the region an (unmasked) old generation address belongs to, or NULL.
+ * There are only ever a handful of regions, since each one is as large as all
+ * the previous ones together, so a linear search is fine.
+ */
+static inline heap_region* regionOf(garbage_collector* gc, uintptr_t address)
+{
+    for (size_t i = 0; i < gc->region_count; ++i)
+        if (address - gc->regions[i].bottom < gc->regions[i].size)
+            return &gc->regions[i];
+    return NULL;
+}
+
+/*
+ * The bit array that has the mark of a cell (an unmasked address in the
+ * old generation or the nursery), and the index of the bit in it.
+ */
+static inline uint64_t* markBitsOf(garbage_collector* gc, uintptr_t cell, size_t* index)
+{
+    if (InNursery(gc, cell))
+    {
+        *index = (cell - (uintptr_t) gc->nursery) / sizeof(cons);
+        return gc->young_bitarray;
+    }
+    const heap_region* region = regionOf(gc, cell);
+    *index = (cell - region->bottom) / sizeof(cons);
+    return region->bitarray;
+}
+
+bool gcInit(garbage_collector* gc, size_t heap_size, size_t max_heap_size,
+            size_t nursery_size, double grow_threshold);
+// unmaps the heap and frees everything gcInit() and the collections allocated
+void gcDestroy(garbage_collector* gc);
+bool growHeap(garbage_collector* gc, size_t min_size);
+// unmaps a region of the old generation (or reserves it again) and frees its bits
+void releaseRegion(heap_region* region);
 bool markAndSweep(garbage_collector* gc);
+bool sweepSome(garbage_collector* gc, size_t max_cells);
+/*
+ * Links the unmarked cells of the words [start, end) of a region's bit array
+ * into a list, and clears their marks. Returns its first cell (NULL if there
+ * are none), and the last one in *last, whose next is left to the caller.
+ */
+cons* sweepWords(garbage_collector* gc, const heap_region* region, size_t start, size_t end,
+                 cons** last);
+bool minorCollect(garbage_collector* gc);
+void rememberCell(garbage_collector* gc, cons* cell);
 
 #endif
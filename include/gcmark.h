@@ -0,0 +1,38 @@
+#ifndef GCMARK_H
+#define GCMARK_H
+
+#include <stddef.h>
+
+/*
+ * Marking on more than one thread (--gc-threads). The thread that collects
+ * marks along with count - 1 helper threads, which are started once and
+ * sleep between collections.
+ *
+ * Every marker has its own Chase-Lev deque of cells to look at: it pushes
+ * and takes at the bottom, and the others steal from the top once their own
+ * deque runs dry. A cell is marked (with an atomic or on its word of the bit
+ * array) before it is pushed, so it is pushed once at most, by whoever set
+ * its bit. What does not fit in a deque goes on the collector's mark stack,
+ * under a lock. Marking is over once every marker is idle with nothing left
+ * anywhere to take or steal.
+ *
+ * Heaps smaller than PARALLEL_MARK_CELLS are marked on one thread all the
+ * same, since waking the helpers costs more than they would save.
+ */
+
+#define PARALLEL_MARK_CELLS (64*1024)
+
+struct garbage_collector;
+typedef struct gc_markers gc_markers;
+
+// NULL if the threads could not be started
+gc_markers* gcMarkersCreate(struct garbage_collector* gc, size_t count);
+void gcMarkersDestroy(gc_markers* markers);
+/*
+ * Marks everything reachable from the stack, in the bit arrays of the old
+ * generation and the nursery. Returns how many old generation cells it
+ * marked.
+ */
+size_t gcMarkParallel(gc_markers* markers);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef GCSTATS_H
+#define GCSTATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+/*
+ * What happened during a single collection. For a minor collection, "mark"
+ * is the time spent copying and "marked" the number of promoted cells.
+ */
+struct gc_event
+{
+    bool major;
+    uint64_t mark_ns;
+    uint64_t sweep_ns;
+    size_t roots;
+    size_t marked;
+    size_t reclaimed;
+    // bytes handed out by CONS since the previous collection
+    size_t allocated;
+};
+typedef struct gc_event gc_event;
+
+struct gc_stats
+{
+    uint64_t start_ns;
+    gc_event* events;
+    size_t count;
+    size_t size;
+    /*
+     * time spent in sweepSome() outside of a collection, with --lazy-sweep,
+     * or waiting for the sweeper, with --concurrent-sweep
+     */
+    uint64_t lazy_sweep_ns;
+};
+typedef struct gc_stats gc_stats;
+
+static inline uint64_t monotonicNs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+gc_stats* gcStatsCreate(void);
+void gcStatsDestroy(gc_stats* stats);
+// returns a zeroed event to be filled in by the collector
+gc_event* gcStatsEvent(gc_stats* stats, bool major);
+// allocated is what CONS handed out since the last collection
+void gcStatsReport(const gc_stats* stats, size_t allocated, size_t heap_size, FILE* out);
+void gcStatsJson(const gc_stats* stats, size_t allocated, size_t heap_size, FILE* out);
+
+#endif
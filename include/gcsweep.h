@@ -0,0 +1,42 @@
+#ifndef GCSWEEP_H
+#define GCSWEEP_H
+
+#include <stddef.h>
+
+#include "cons.h"
+
+/*
+ * Sweeping on a thread of its own (--concurrent-sweep). A major collection
+ * only marks, and hands the regions it marked to the sweeper, which goes
+ * through them SWEEP_SEGMENT words of the bit array at a time while the
+ * program runs on.
+ *
+ * The free cells of every segment are linked into a list, and the list is
+ * pushed as a whole (with a compare and swap) on a stack of swept cells the
+ * sweeper shares with the allocator. When the freelist runs dry, the
+ * allocator takes the whole stack at once with an exchange, so neither
+ * side ever takes a lock, unless the allocator finds nothing swept yet and
+ * has to wait for the next segment.
+ *
+ * The next collection waits for the sweep to be over before it marks.
+ */
+
+#define SWEEP_SEGMENT 64
+
+struct garbage_collector;
+typedef struct gc_sweeper gc_sweeper;
+
+// NULL if the thread could not be started
+gc_sweeper* gcSweeperCreate(struct garbage_collector* gc);
+void gcSweeperDestroy(gc_sweeper* sweeper);
+// sweeps the first regions regions of the old generation, from now on
+void gcSweepStart(gc_sweeper* sweeper, size_t regions);
+/*
+ * The cells swept since the last call, linked like the freelist. If there
+ * are none yet, waits for some. NULL once the whole heap has been swept.
+ */
+cons* gcSweepTake(gc_sweeper* sweeper);
+// waits for the sweep to be over, and forgets the cells no one took
+void gcSweepWait(gc_sweeper* sweeper);
+
+#endif
@@ -0,0 +1,391 @@
+#ifndef HANDLERS_H
+#define HANDLERS_H
+
+/*
+ * The bodies of the interpreter handlers. Every DO_X() executes the X
+ * instruction at ip (see threaded.h) and leaves ip at the instruction that
+ * runs next, but does not dispatch. That way a handler is DO_X() followed by
+ * DISPATCH(), and a superinstruction (see superinstructions.h) is just the
+ * bodies of its parts one after the other, with a single dispatch at the end.
+ *
+ * They use the locals of the interpreter loop in vm.c, the vm_t among them,
+ * and are not meant to be used anywhere else. A handler that cannot go on
+ * returns the vm_status from there.
+ *
+ * The top of the stack lives in tos, and sp points at the slot it belongs
+ * in, so vm->stack.data only holds the entries below it. Popping the
+ * second entry is *--sp and pushing is *sp++ = tos. An empty stack still
+ * has a top: data[0] is never used by the program and always holds 0.
+ *
+ * vm->stack.top is only brought up to date (SYNC_STACK()) where
+ * something else looks at the stack: a collection, native code, a snapshot
+ * and halt.
+ */
+
+#define DISPATCH() goto *(void *)(ip->handler)
+
+// writes the cached top back, so that vm->stack is the whole stack
+#define SYNC_STACK()                             \
+    do {                                         \
+        *sp = tos;                               \
+        vm->stack.top = sp - vm->stack.data + 1; \
+    } while (0)
+
+// the opposite, after vm->stack might have changed
+#define RELOAD_STACK()                            \
+    do {                                          \
+        sp  = &vm->stack.data[vm->stack.top - 1]; \
+        tos = *sp;                                \
+    } while (0)
+
+/*
+ * A jump to an earlier record is a back edge, and may run native code (see
+ * jit.h) before it is done. It is also where the sampling profiler learns
+ * which loop is running (see sampler.h).
+ */
+#define BACK_EDGE()                         \
+    do {                                    \
+        vm->sampler.ip = ip;                \
+        if (vm->jit.enabled)                \
+        {                                   \
+            SYNC_STACK();                   \
+            ip = jitBackEdge(&vm->jit, ip); \
+            RELOAD_STACK();                 \
+            if (!ip)                        \
+                return VM_OUT_OF_MEMORY;    \
+        }                                   \
+    } while (0)
+
+#define DO_JUMP()                       \
+    do {                                \
+        instruction* from = ip;         \
+        ip = ip->target;                \
+        PROFILE_JUMP(&vm->profile, ip); \
+        if (ip <= from)                 \
+            BACK_EDGE();                \
+    } while (0)
+
+#define DO_JNZ()                            \
+    do {                                    \
+        arg1 = tos;                         \
+        tos  = *--sp;                       \
+        if (arg1 != 0)                      \
+        {                                   \
+            instruction* from = ip;         \
+            ip = ip->target;                \
+            PROFILE_JUMP(&vm->profile, ip); \
+            if (ip <= from)                 \
+                BACK_EDGE();                \
+        }                                   \
+        else                                \
+            ip++;                           \
+    } while (0)
+
+#define DO_DUP()                                                  \
+    do {                                                          \
+        /* 0 is the old top, which is at sp[-1] after the push */ \
+        *sp++ = tos;                                              \
+        tos   = sp[-1 - (intptr_t) ip->arg];                      \
+        ip++;                                                     \
+    } while (0)
+
+#define DO_SWAP()                           \
+    do {                                    \
+        if (ip->arg != 0)                   \
+        {                                   \
+            arg1 = sp[-(intptr_t) ip->arg]; \
+            sp[-(intptr_t) ip->arg] = tos;  \
+            tos = arg1;                     \
+        }                                   \
+        ip++;                               \
+    } while (0)
+
+#define DO_DROP()            \
+    do {                     \
+        /* pop and ignore */ \
+        ip++;                \
+        tos = *--sp;         \
+    } while (0)
+
+#define DO_PUSH()                                                           \
+    do {                                                                    \
+        /* the operand was sign extended and encoded when it was decoded */ \
+        *sp++ = tos;                                                        \
+        tos   = ip->arg;                                                    \
+        ip++;                                                               \
+    } while (0)
+#define DO_PUSH1() DO_PUSH()
+#define DO_PUSH2() DO_PUSH()
+#define DO_PUSH4() DO_PUSH()
+
+#ifdef VM_TAGGED
+/*
+ * See value.h. The words of two integers add and subtract as they are, and
+ * the compiler checks the overflow flag of the instruction that does it.
+ */
+#define OVERFLOWED()                                       \
+    do {                                                   \
+        fail(vm->error, "integer overflow at %x", ip->pc); \
+        return VM_OVERFLOW;                                \
+    } while (0)
+
+#define DO_ADD()                                                    \
+    do {                                                            \
+        arg1 = *--sp;                                               \
+        if (__builtin_add_overflow((intptr_t) arg1, (intptr_t) tos, \
+                                   (intptr_t*) &tos))               \
+            OVERFLOWED();                                           \
+        ip++;                                                       \
+    } while (0)
+
+#define DO_SUB()                                                    \
+    do {                                                            \
+        arg1 = *--sp;                                               \
+        if (__builtin_sub_overflow((intptr_t) arg1, (intptr_t) tos, \
+                                   (intptr_t*) &tos))               \
+            OVERFLOWED();                                           \
+        ip++;                                                       \
+    } while (0)
+
+// one of the two loses its tag, so that the product has a single one
+#define DO_MUL()                                                   \
+    do {                                                           \
+        arg1 = *--sp;                                              \
+        if (__builtin_mul_overflow(ValueInt(arg1), (intptr_t) tos, \
+                                   (intptr_t*) &tos))              \
+            OVERFLOWED();                                          \
+        ip++;                                                      \
+    } while (0)
+
+// the quotient of the smallest integer and -1 is the only one that does not fit
+#define DO_DIV()                                      \
+    do {                                              \
+        arg1 = *--sp;                                 \
+        arg2 = ValueInt(arg1) / ValueInt(tos);        \
+        if (__builtin_add_overflow((intptr_t) arg2,   \
+                                   (intptr_t) arg2,   \
+                                   (intptr_t*) &tos)) \
+            OVERFLOWED();                             \
+        ip++;                                         \
+    } while (0)
+
+#define DO_MOD()                                         \
+    do {                                                 \
+        ip++;                                            \
+        arg1 = *--sp;                                    \
+        tos  = IntValue(ValueInt(arg1) % ValueInt(tos)); \
+    } while (0)
+#else
+#define DO_ADD()                       \
+    do {                               \
+        ip++;                          \
+        arg1 = *--sp;                  \
+        tos  = (arg1 + tos) & GC_MASK; \
+    } while (0)
+
+#define DO_SUB()                       \
+    do {                               \
+        ip++;                          \
+        arg1 = *--sp;                  \
+        tos  = (arg1 - tos) & GC_MASK; \
+    } while (0)
+
+#define DO_MUL()                       \
+    do {                               \
+        ip++;                          \
+        arg1 = *--sp;                  \
+        tos  = (arg1 * tos) & GC_MASK; \
+    } while (0)
+
+#define DO_DIV()                       \
+    do {                               \
+        ip++;                          \
+        arg1 = *--sp;                  \
+        tos  = (arg1 / tos) & GC_MASK; \
+    } while (0)
+
+#define DO_MOD()                       \
+    do {                               \
+        ip++;                          \
+        arg1 = *--sp;                  \
+        tos  = (arg1 % tos) & GC_MASK; \
+    } while (0)
+#endif
+
+#define DO_EQ()                       \
+    do {                              \
+        ip++;                         \
+        arg1 = *--sp;                 \
+        tos  = IntValue(arg1 == tos); \
+    } while (0)
+
+#define DO_NE()                       \
+    do {                              \
+        ip++;                         \
+        arg1 = *--sp;                 \
+        tos  = IntValue(arg1 != tos); \
+    } while (0)
+
+// the ordered comparisons are signed, see Compare() in value.h
+#define DO_LT()                                 \
+    do {                                        \
+        ip++;                                   \
+        arg1 = *--sp;                           \
+        tos  = IntValue(Compare(arg1, <, tos)); \
+    } while (0)
+
+#define DO_GT()                                 \
+    do {                                        \
+        ip++;                                   \
+        arg1 = *--sp;                           \
+        tos  = IntValue(Compare(arg1, >, tos)); \
+    } while (0)
+
+#define DO_LE()                                  \
+    do {                                         \
+        ip++;                                    \
+        arg1 = *--sp;                            \
+        tos  = IntValue(Compare(arg1, <=, tos)); \
+    } while (0)
+
+#define DO_GE()                                  \
+    do {                                         \
+        ip++;                                    \
+        arg1 = *--sp;                            \
+        tos  = IntValue(Compare(arg1, >=, tos)); \
+    } while (0)
+
+#define DO_NOT()                  \
+    do {                          \
+        ip++;                     \
+        tos = IntValue(tos != 0); \
+    } while (0)
+
+#define DO_AND()                                \
+    do {                                        \
+        ip++;                                   \
+        arg1 = *--sp;                           \
+        tos  = IntValue(arg1 != 0 && tos != 0); \
+    } while (0)
+
+#define DO_OR()                                 \
+    do {                                        \
+        ip++;                                   \
+        arg1 = *--sp;                           \
+        tos  = IntValue(arg1 != 0 || tos != 0); \
+    } while (0)
+
+#define DO_INPUT()                      \
+    do {                                \
+        ip++;                           \
+        char_input = vmioGetc(&vm->io); \
+        *sp++ = tos;                    \
+        tos   = IntValue(char_input);   \
+    } while (0)
+
+#define DO_OUTPUT()                     \
+    do {                                \
+        ip++;                           \
+        char_output = ValueInt(tos);    \
+        tos = *--sp;                    \
+        vmioPutc(&vm->io, char_output); \
+    } while (0)
+
+#define DO_CONS()                                                           \
+    do {                                                                    \
+        /* only in the compact build can a value not fit, see gc.h */       \
+        if (!FitsCell(tos) || !FitsCell(sp[-1]))                            \
+        {                                                                   \
+            fail(vm->error, "a value too large for a cell at %x", ip->pc);  \
+            return VM_OVERFLOW;                                             \
+        }                                                                   \
+        ip++;                                                               \
+        if (vm->gc.young_ptr == vm->gc.young_limit)                         \
+        {                                                                   \
+            /*                                                              \
+             * The nursery is full. This returns false only if the          \
+             * survivors did not fit in the old generation, even            \
+             * after it was collected and grown up to --heap-max.           \
+             * The collector moves the cells the stack points to, so        \
+             * it has to see all of it, top included.                       \
+             */                                                             \
+            SYNC_STACK();                                                   \
+            if (!minorCollect(&vm->gc))                                     \
+            {                                                               \
+                vmioPrintf(&vm->io, "Memory has been exhausted.\n");        \
+                return VM_OUT_OF_MEMORY;                                    \
+            }                                                               \
+            RELOAD_STACK();                                                 \
+        }                                                                   \
+        poppedCell       = vm->gc.young_ptr++; /* this is a real address */ \
+        HEAP_PROFILE_CONS(&vm->gc, poppedCell, (ip - 1)->pc);               \
+                                                                            \
+        /*                                                                  \
+         * This must NOT be masked. Check the mark and sweep function in    \
+         * gc.c for more information.                                       \
+         */                                                                 \
+        arg2             = tos; /* tail */                                  \
+        WriteBarrier(&vm->gc, poppedCell, arg2);                            \
+        poppedCell->tail = WordOf(&vm->gc, arg2);                           \
+                                                                            \
+        /*                                                                  \
+         * This must also NOT be masked, irregardless of what it is, for    \
+         * the same reason as above.                                        \
+         */                                                                 \
+        arg1             = *--sp; /* head */                                \
+        WriteBarrier(&vm->gc, poppedCell, arg1);                            \
+        poppedCell->head = WordOf(&vm->gc, arg1);                           \
+                                                                            \
+        tos              = CellValue(poppedCell);                           \
+    } while (0)
+
+#define DO_HD()                                          \
+    do {                                                 \
+        ip++;                                            \
+        poppedCell = CellOf(tos);                        \
+        tos        = ValueOf(&vm->gc, poppedCell->head); \
+    } while (0)
+
+#define DO_TL()                                          \
+    do {                                                 \
+        ip++;                                            \
+        poppedCell = CellOf(tos);                        \
+        tos        = ValueOf(&vm->gc, poppedCell->tail); \
+    } while (0)
+
+// see verify.h, overflows are left to the guard page (see stack.h)
+#define DO_CHECK()                                              \
+    do {                                                        \
+        arg1 = sp - vm->stack.data; /* the depth */             \
+        if (arg1 < ip->depth.min)                               \
+        {                                                       \
+            fail(vm->error, "stack underflow at %x", ip->pc);   \
+            return VM_STACK_ERROR;                              \
+        }                                                       \
+        ip++;                                                   \
+    } while (0)
+
+// see snapshot.h, the image resumes at the instruction after this one
+#define DO_SNAPSHOT()                                                       \
+    do {                                                                    \
+        if (vm->options.snapshot)                                           \
+        {                                                                   \
+            SYNC_STACK();                                                   \
+            if (!snapshotWrite(vm->options.snapshot, &vm->gc,               \
+                               vm->program->hash, ip->pc + SIZEOF_SNAPSHOT, \
+                               vm->error))                                  \
+                return VM_SNAPSHOT_ERROR;                                   \
+            RELOAD_STACK();                                                 \
+        }                                                                   \
+        ip++;                                                               \
+    } while (0)
+
+#define DO_CLOCK()                                           \
+    do {                                                     \
+        ip++;                                                \
+        end = clock();                                       \
+        time_spent = (double)(end - begin) / CLOCKS_PER_SEC; \
+        vmioPrintf(&vm->io, "%0.6lf\n", time_spent);         \
+    } while (0)
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef HEAPPROF_H
+#define HEAPPROF_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "gc.h"
+
+/*
+ * The heap profiler of the profiling build (make profile, with
+ * --heap-profile). Every cell is tagged with its allocation site, the pc of
+ * the CONS that made it, and the number of major collections it has lived
+ * through. The tags are in a side table, one per region and one for the
+ * nursery, indexed like the bit arrays, so cells keep their size. A
+ * promotion copies the tag along with the cell.
+ *
+ * After every major collection, the marks say which cells are alive, and a
+ * line with the sites that hold the most of them goes to the report. When
+ * the run is over (out of memory included), the report gets a table of all
+ * the sites, and for each one the shortest path that keeps one of its cells
+ * alive, from a stack entry through the cells on the way. With --heap-graph,
+ * the sites and how many references go from one to another are written as
+ * a graph for dot (Graphviz), the stack being a node of its own.
+ *
+ * Nothing of this is in the other builds: the hooks expand to nothing.
+ */
+
+struct heap_tag
+{
+    // the pc of the CONS plus one, 0 for a cell of unknown origin (restored from a snapshot)
+    uint32_t site;
+    // the major collections the cell has lived through, up to UINT32_MAX
+    uint32_t age;
+};
+typedef struct heap_tag heap_tag;
+
+struct heap_site
+{
+    uint64_t allocated;
+    // promoted out of the nursery
+    uint64_t promoted;
+    // alive after the last major collection, and the most ever
+    uint64_t live;
+    uint64_t peak;
+    // the cells of the site alive after a major collection, summed over all of them
+    uint64_t survivals;
+    uint32_t oldest;
+};
+typedef struct heap_site heap_site;
+
+struct heap_profile
+{
+    const uint8_t* program;
+    size_t length;
+    // indexed by pc + 1, [0] is for the cells of unknown origin
+    heap_site* sites;
+    heap_tag* young;
+    // the tags of gc->regions[i], and the bottom of the region they were made for
+    heap_tag* tags[MAX_REGIONS];
+    uintptr_t bottoms[MAX_REGIONS];
+    size_t sizes[MAX_REGIONS];
+    size_t collections;
+    FILE* out;
+    const char* graph;
+};
+typedef struct heap_profile heap_profile_t;
+
+/*
+ * The report is written to path ("-" for stderr), the graph to graph if it
+ * is not NULL. Returns false (and sets errno) if memory runs out or path
+ * cannot be opened.
+ */
+bool heapProfileInit(heap_profile_t* profile, const garbage_collector* gc,
+                     const uint8_t* program, size_t length, const char* path, const char* graph);
+void heapProfileDestroy(heap_profile_t* profile);
+// the rest is only ever called through the hooks below
+void heapProfileMarked(heap_profile_t* profile, garbage_collector* gc);
+heap_tag* heapProfileTag(heap_profile_t* profile, garbage_collector* gc, uintptr_t cell);
+// the table, the retention paths and the graph, for the heap as it is now
+void heapProfileReport(heap_profile_t* profile, garbage_collector* gc);
+
+#ifdef VM_PROFILE
+// cell is in the nursery, and was just bumped
+static inline void heapProfileCons(heap_profile_t* profile, uintptr_t nursery, const cons* cell,
+                                   uint32_t pc)
+{
+    const uint32_t site = pc < profile->length ? pc + 1 : 0;
+    profile->young[((uintptr_t) cell - nursery)/sizeof(cons)] = (heap_tag) { site, 0 };
+    profile->sites[site].allocated++;
+}
+
+#define HEAP_PROFILE_CONS(gc, cell, pc)                                                    \
+    do {                                                                                   \
+        if ((gc)->heap_profile)                                                            \
+            heapProfileCons((gc)->heap_profile, (uintptr_t) (gc)->nursery, cell, pc);      \
+    } while (0)
+#define HEAP_PROFILE_PROMOTE(gc, young, old)                                               \
+    do {                                                                                   \
+        if ((gc)->heap_profile)                                                            \
+        {                                                                                  \
+            heap_tag* tag = heapProfileTag((gc)->heap_profile, gc, (uintptr_t) (old));     \
+            *tag = *heapProfileTag((gc)->heap_profile, gc, (uintptr_t) (young));           \
+            (gc)->heap_profile->sites[tag->site].promoted++;                               \
+        }                                                                                  \
+    } while (0)
+#define HEAP_PROFILE_MARKED(gc)                                                            \
+    do {                                                                                   \
+        if ((gc)->heap_profile)                                                            \
+            heapProfileMarked((gc)->heap_profile, gc);                                     \
+    } while (0)
+#else
+#define HEAP_PROFILE_CONS(gc, cell, pc)
+#define HEAP_PROFILE_PROMOTE(gc, young, old)
+#define HEAP_PROFILE_MARKED(gc)
+#endif
+
+#endif
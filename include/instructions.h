@@ -58,8 +58,18 @@
 #define SIZEOF_INPUT 1
 #define OUTPUT 0X18     // pops ASCII value from stack, prints character to stdout.
 #define SIZEOF_OUTPUT 1
+/* WIDE JUMPS */
+// the same as JUMP and JNZ, for targets past the first 64 KB.
+#define JUMP4 0X19      // jump to address (4 bytes).
+#define SIZEOF_JUMP4 5
+#define JNZ4 0X1A       // pop, and jump to address (4 bytes)
+                        // if popped element not zero.
+#define SIZEOF_JNZ4 5
 #define CLOCK 0X2A
 #define SIZEOF_CLOCK 1  // prints the elapsed time since start of execution.
+#define SNAPSHOT 0X2B
+#define SIZEOF_SNAPSHOT 1 // writes the stack and the heap to the --snapshot
+                          // image (see snapshot.h), if there is one.
 #define CONS 0X30
 #define SIZEOF_CONS 1   // pops b, then pops a, allocates cons(a, b) on the heap
                         // and pushes the address on the stack.
@@ -68,5 +78,12 @@
 #define TL 0X32         // pops a cons adderss and pushed its tail.
 #define SIZEOF_TL 1
 
+/*
+ * Never part of a program (the verifier rejects it), this is the opcode of
+ * the records that check the stack depth before an instruction the verifier
+ * could not prove safe.
+ */
+#define CHECK 0XFF
+
 #endif
 
@@ -0,0 +1,75 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "threaded.h"
+#include "gc.h"
+#include "vmio.h"
+
+/*
+ * A baseline JIT for hot loops. The interpreter counts how many times every
+ * record is the target of a backward jump, and once a target has been
+ * reached JIT_THRESHOLD times, the records from there on are compiled to
+ * x86-64 code. From then on, the backward jumps to it run the native code
+ * instead, which returns the record the interpreter picks up from.
+ *
+ * Arithmetic, comparisons, logic, stack shuffling and jumps are compiled
+ * inline, with the top of the stack kept in registers. CONS, HD, TL and the
+ * I/O instructions call back into C. Anything else (CLOCK, HALT, bad
+ * opcodes) ends the compiled code and returns to the interpreter.
+ */
+
+#define JIT_THRESHOLD 1000
+
+struct jit;
+
+// native code for the records starting at some index, see jitBackEdge()
+typedef instruction* (*jit_code)(struct jit* jit);
+
+struct jit
+{
+    bool enabled;
+    // what the calls out of the native code work on
+    garbage_collector* gc;
+    vmio_t* io;
+    // the translated program (see threaded.h)
+    instruction* program;
+    size_t count;
+    // per record: how many times it was jumped back to, and its native code
+    uint32_t* counters;
+    jit_code* entries;
+    // the executable memory the native code goes in
+    uint8_t* memory;
+    size_t memory_size;
+    size_t memory_used;
+};
+typedef struct jit jit_t;
+
+bool jitInit(jit_t* jit, instruction* program, size_t count, garbage_collector* gc,
+             vmio_t* io);
+void jitDestroy(jit_t* jit);
+// compiles the records from index on. Returns false if that is not possible
+bool jitCompile(jit_t* jit, size_t index);
+
+/*
+ * Called by the interpreter on every jump that goes back to target. Counts
+ * the jump, and runs the native code for target if there is any (or if it
+ * just became hot). Returns the record to carry on from, or NULL if the
+ * native code ran out of memory (it has said so already).
+ */
+static inline instruction* jitBackEdge(jit_t* jit, instruction* target)
+{
+    if (!jit->enabled)
+        return target;
+    const size_t index = target - jit->program;
+    if (!jit->entries[index] && ++jit->counters[index] == JIT_THRESHOLD)
+        jitCompile(jit, index);
+    if (jit->entries[index])
+        return jit->entries[index](jit);
+    return target;
+}
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Execution counters for the profiling build (make profile). In the normal
+ * build the hooks below expand to nothing, so the interpreter loop does not
+ * pay for them at all.
+ */
+struct profile
+{
+    const uint8_t* program;
+    size_t length;
+    uint64_t op_count[256];
+    uint64_t op_cycles[256];
+    // indexed by the offset of the instruction in the program
+    uint64_t* pc_count;
+    uint64_t* pc_cycles;
+    uint64_t* target_count;
+    // with --profile-cycles, the time from one handler to the next (rdtsc)
+    bool cycles;
+    uint64_t last_tsc;
+    size_t last_pc;
+};
+typedef struct profile profile_t;
+
+bool profileInit(profile_t* profile, const uint8_t* program, size_t length, bool cycles);
+void profileDestroy(profile_t* profile);
+// the per opcode table, the hottest jump targets and an annotated listing
+void profileReport(const profile_t* profile, FILE* out);
+
+#ifdef VM_PROFILE
+#include <x86intrin.h>
+
+/*
+ * Both take offsets into the program. The interpreter runs a few records of
+ * its own that are not in the program (see threaded.h), those are not
+ * counted.
+ */
+static inline void profileInstruction(profile_t* profile, size_t offset)
+{
+    if (offset >= profile->length)
+        return;
+    profile->pc_count[offset]++;
+    profile->op_count[profile->program[offset]]++;
+    if (profile->cycles)
+    {
+        const uint64_t now = __rdtsc();
+        if (profile->last_tsc)
+        {
+            profile->pc_cycles[profile->last_pc] += now - profile->last_tsc;
+            profile->op_cycles[profile->program[profile->last_pc]] += now - profile->last_tsc;
+        }
+        profile->last_tsc = now;
+        profile->last_pc  = offset;
+    }
+}
+
+static inline void profileJump(profile_t* profile, size_t target)
+{
+    if (target < profile->length)
+        profile->target_count[target]++;
+}
+
+#define PROFILE_INSTRUCTION(p, ip)  profileInstruction(p, (ip)->pc)
+#define PROFILE_JUMP(p, target)     profileJump(p, (target)->pc)
+#else
+#define PROFILE_INSTRUCTION(p, ip)
+#define PROFILE_JUMP(p, target)
+#endif
+
+#endif
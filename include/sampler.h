@@ -0,0 +1,70 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "threaded.h"
+
+/*
+ * The sampling profiler (--sample), which any build has, and which costs
+ * too little to change the timings it takes. ITIMER_PROF sends SIGPROF
+ * every 1/rate seconds of CPU time the process uses, and the handler counts
+ * a sample for what the VM on that thread was doing. The helper threads of
+ * the collector (see gcmark.h and gcsweep.h) block SIGPROF, so their CPU
+ * time lands on the VM thread too: the parallel markers' on the major
+ * collection it takes part in, the concurrent sweeper's on whatever the VM
+ * runs meanwhile.
+ *
+ * The interpreter does not say which instruction it is at, that would cost
+ * a store per instruction. It only writes the record of every back edge it
+ * takes to ip (see BACK_EDGE() in handlers.h), so a sample goes to the loop
+ * that was running, by the pc of its first instruction. Native code is only
+ * ever entered on a back edge, so its time goes to its loop as well. The
+ * handler also looks at what the collector was doing (gc->collecting), so
+ * the time of the collections is told apart.
+ *
+ * The report has the sampled pcs, and the loops of the program (from the
+ * target of a back edge to the jump) with every sample inside them, nested
+ * loops included. The samples are also written as folded stacks, one
+ * "frame;frame;... count" line per place, for flamegraph.pl and the tools
+ * that take its input: the loops a pc is in, outermost first, then the pc,
+ * then the collection if there was one.
+ */
+
+#define SAMPLE_RATE 1000
+
+struct sampler
+{
+    // the last back edge taken, written by the interpreter and read by the handler
+    const instruction* volatile ip;
+    const volatile int* collecting;
+    const uint8_t* program;
+    size_t length;
+    const instruction* code;
+    size_t count;
+    /*
+     * Indexed by pc, with [length] for the records that are not in the
+     * program, and by what the collector was doing (0, GC_MINOR, GC_MAJOR).
+     */
+    uint64_t* samples[3];
+    unsigned int rate;
+};
+typedef struct sampler sampler_t;
+
+bool samplerInit(sampler_t* sampler, const uint8_t* program, size_t length,
+                 const instruction* code, size_t count,
+                 const volatile int* collecting, unsigned int rate);
+void samplerDestroy(sampler_t* sampler);
+/*
+ * Counts the samples that land on this thread for sampler, until
+ * samplerStop(). The timer runs as long as a sampler is started on any
+ * thread, at the rate of the first one.
+ */
+bool samplerStart(sampler_t* sampler);
+void samplerStop(void);
+// the hot spots to out, and the folded stacks to path
+void samplerReport(const sampler_t* sampler, const char* path, FILE* out);
+
+#endif
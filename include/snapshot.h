@@ -0,0 +1,66 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "gc.h"
+
+/*
+ * Warm starts. A program that spends its first phase building the same cons
+ * structures every time can run SNAPSHOT once they are built: with
+ * --snapshot <image>, that writes the stack, the heap and what the collector
+ * knows about it to image, and the program goes on. A later
+ *
+ *     ./vm --restore image program.bin
+ *
+ * starts right after the SNAPSHOT instead of at the beginning, with the heap
+ * as it was. Without --snapshot, SNAPSHOT does nothing.
+ *
+ * The image is
+ *   - a header: the program's hash, the offset to resume at, the depth of
+ *     the stack and where every old generation region was mapped
+ *   - the stack
+ *   - the regions themselves, each starting on a page
+ *   - the mark bits of the regions, which tell the live cells from the free
+ *     ones
+ *
+ * Taking one empties the nursery (a minor collection) and then marks the old
+ * generation without sweeping it. The regions are written as they are, and
+ * the sweep goes on afterwards as usual.
+ *
+ * Restoring maps the regions straight from the image, privately, so that
+ * nothing is read before it is touched and the image never changes. They go
+ * back at the addresses they had if those are free, and then no cell needs
+ * to be looked at. Otherwise every heap address in a live cell and on the
+ * stack is moved along with its region. Either way the free cells are then
+ * swept onto a new freelist, which with --lazy-sweep happens bit by bit as
+ * cells are needed.
+ *
+ * The input is not part of the image: INPUT reads the restored run's own
+ * stdin from its beginning.
+ */
+
+// a hash of the program, before fusion, so that an image only runs with its program
+uint64_t snapshotHash(const uint8_t* bytes, size_t length);
+/*
+ * Writes the image of gc and its stack (gc->machine) to path, resuming at
+ * pc. The file is replaced as a whole, a reader never sees half an image.
+ * Returns false with a message in error (VM_ERROR_SIZE bytes) if it could
+ * not be written, or if emptying the nursery ran out of memory.
+ */
+bool snapshotWrite(const char* path, garbage_collector* gc, uint64_t program_hash,
+                   size_t pc, char* error);
+/*
+ * Replaces the old generation and the stack of gc with the ones in the image
+ * at path, and stores the offset to resume at in pc. Whatever gc held before
+ * (the nursery included) is thrown away. On failure gc is left as it was,
+ * except in the compact build: its regions have to be mapped where the old
+ * ones are, so once the image is found to be valid and to fit, a failure
+ * to map or read it leaves the old generation empty.
+ */
+bool snapshotRestore(const char* path, garbage_collector* gc, uint64_t program_hash,
+                     size_t* pc, char* error);
+
+#endif
@@ -1,11 +1,21 @@
 #include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <setjmp.h>
 #ifndef STACK_H
 #define STACK_H
-#define STACK_SIZE 256
+
+/*
+ * The most entries a stack can hold. Only the address space is taken for
+ * them up front: the entries are backed by memory STACK_CHUNK bytes at a
+ * time, as the stack first reaches them.
+ */
+#define STACK_SIZE  (1 << 20)
+#define STACK_CHUNK (64*1024)
 
 struct stack
 {
-    /* 
+    /*
      * The stack has ... a stack of data.
      * The data can be integers and addresses
      * therefore we need a type that can
@@ -13,11 +23,11 @@ struct stack
      *
      * In order for the garbage collection to function,
      * 2 bits seem to be needed. One to signify whether
-     * the content of the stack is a pointer to the 
+     * the content of the stack is a pointer to the
      * heap and another to signify whether it is to
      * be freed.
      */
-    uintptr_t data[STACK_SIZE];
+    uintptr_t* data;
     /*
      * Of course, a pointer to the (free) top of the stack
      * the pointerW is to be used as an index.
@@ -26,9 +36,28 @@ struct stack
      * of them wrap around eventually.
      */
     int32_t top;
+    // how many entries from data on are backed by memory
+    size_t committed;
 };
 typedef struct stack stack_t;
 
+/*
+ * Nothing compares the stack pointer with anything when pushing. The
+ * entries past the committed ones are mapped PROT_NONE, and so is a guard
+ * page right after the last of the STACK_SIZE entries, which is never
+ * backed. While a thread runs with stackWatch(), a push that faults in the
+ * first place has the SIGSEGV handler commit some more entries and go on,
+ * and one that faults on the guard page is a stack overflow, which the
+ * handler turns into a siglongjmp() to overflow (with 1). Faults anywhere
+ * else are left to whatever handled SIGSEGV before.
+ */
+bool stackInit(stack_t *s);
+void stackDestroy(stack_t *s);
+// commits the first entries entries, false if that is more than STACK_SIZE
+bool stackReserve(stack_t *s, size_t entries);
+void stackWatch(stack_t *s, sigjmp_buf *overflow);
+void stackUnwatch(void);
+
 // write the contents of i to the top of the stack
 int32_t stackPush(stack_t *s, uintptr_t i);
 // copy i-th element and push it. 0 is top.
@@ -0,0 +1,34 @@
+/*
+ * Superinstructions, generated by tools/fusion-table from
+ * gc-stress-test.profile test-hello-world.profile
+ *
+ * SUPER2(name, opcode, first, second)
+ * SUPER3(name, opcode, first, second, third)
+ *
+ * The opcodes are unused ones, counting up from 0x40. The number after
+ * every line is how many times its first instruction ran in the profiles.
+ */
+SUPER2(DUP_HD, 0x40, DUP, HD) // 2142714000
+SUPER2(CONS_CONS, 0x41, CONS, CONS) // 1428714000
+SUPER3(CONS_CONS_TL, 0x42, CONS, CONS, TL) // 1428714000
+SUPER2(CONS_TL, 0x43, CONS, TL) // 1428714000
+SUPER3(DUP_HD_PUSH1, 0x44, DUP, HD, PUSH1) // 1428000000
+SUPER2(DUP_TL, 0x45, DUP, TL) // 1428000000
+SUPER2(HD_PUSH1, 0x46, HD, PUSH1) // 1428000000
+SUPER2(TL_DUP, 0x47, TL, DUP) // 1428000000
+SUPER3(TL_DUP_HD, 0x48, TL, DUP, HD) // 1428000000
+SUPER2(DUP_JNZ, 0x49, DUP, JNZ) // 715429494
+SUPER2(PUSH1_SUB, 0x4A, PUSH1, SUB) // 714714748
+SUPER2(DUP_CONS, 0x4B, DUP, CONS) // 714714000
+SUPER3(DUP_CONS_CONS, 0x4C, DUP, CONS, CONS) // 714714000
+SUPER3(DUP_HD_DUP, 0x4D, DUP, HD, DUP) // 714714000
+SUPER2(DUP_PUSH2, 0x4E, DUP, PUSH2) // 714714000
+SUPER3(DUP_PUSH2_GT, 0x4F, DUP, PUSH2, GT) // 714714000
+SUPER2(GT_JNZ, 0x50, GT, JNZ) // 714714000
+SUPER2(HD_DUP, 0x51, HD, DUP) // 714714000
+SUPER3(HD_DUP_JNZ, 0x52, HD, DUP, JNZ) // 714714000
+SUPER2(PUSH2_GT, 0x53, PUSH2, GT) // 714714000
+SUPER3(PUSH2_GT_JNZ, 0x54, PUSH2, GT, JNZ) // 714714000
+SUPER3(PUSH1_SUB_DUP, 0x55, PUSH1, SUB, DUP) // 714000017
+SUPER2(SUB_DUP, 0x56, SUB, DUP) // 714000017
+SUPER2(ADD_JUMP, 0x57, ADD, JUMP) // 714000000
@@ -0,0 +1,68 @@
+#ifndef THREADED_H
+#define THREADED_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "verify.h"
+
+/*
+ * The program as the interpreter runs it: one record per instruction, with
+ * everything that used to be decoded from the bytes on every execution
+ * worked out once when the program is loaded.
+ */
+struct instruction
+{
+    // the label of the handler, taken from the interpreter's labels[]
+    const void* handler;
+    union
+    {
+        /*
+         * The operand of PUSH1/PUSH2/PUSH4 (sign extended and masked, ready
+         * to be pushed) or of DUP/SWAP.
+         */
+        uintptr_t arg;
+        // where JUMP and JNZ go
+        struct instruction* target;
+        // the depth a CHECK lets through
+        struct
+        {
+            uint16_t min;
+        } depth;
+    };
+    /*
+     * The offset of the instruction in the bytecode, for profiles. The
+     * records that are not in the bytecode (the JUMPs and HALTs added by
+     * translateProgram) have the length of the program here, a CHECK has
+     * the offset of the instruction it guards.
+     */
+    uint32_t pc;
+    /*
+     * The opcode the record runs, for the JIT. A superinstruction record has
+     * the opcode of its first part here.
+     */
+    uint8_t opcode;
+};
+typedef struct instruction instruction;
+
+/*
+ * Decodes the program, starting at offset 0 and at every jump target. A
+ * fall through into code that was decoded already becomes a JUMP there, and
+ * running off the end of the program (or jumping past it) reaches a HALT,
+ * just like the zeroes after the bytecode used to. The program must be
+ * followed by a few zero bytes, so that a cut off operand reads zeroes.
+ *
+ * If checks is not NULL (see verify.h), every instruction that needs one gets
+ * a CHECK record in front of it, which is where jumps to it go as well.
+ * This does not work with superinstructions, since a fused handler expects
+ * the records of its parts right after its own.
+ *
+ * labels must map every opcode (superinstructions and CHECK included) to its
+ * handler. Returns NULL if memory runs out, the first record is the entry
+ * point.
+ */
+instruction* translateProgram(const uint8_t* program, size_t length,
+                              const stack_check* checks, void* const labels[256],
+                              size_t* count);
+
+#endif
@@ -11,5 +11,6 @@ uintptr_t get1Byte(void *ptr);
 uintptr_t get2Byte(void *ptr);
 uintptr_t get2ByteAddress(void *ptr);
 uintptr_t get4Byte(void *ptr);
+uintptr_t get4ByteAddress(void *ptr);
 
 #endif
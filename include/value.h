@@ -0,0 +1,55 @@
+#ifndef VALUE_H
+#define VALUE_H
+
+#include <stdint.h>
+
+#include "cons.h"
+#include "utils.h"
+
+/*
+ * What a word on the stack, or in a cons cell, means. There are two
+ * encodings, picked at build time.
+ *
+ * The default one keeps an integer as it is and marks a heap address with
+ * the top bit (MARK_FAKE). Every arithmetic result is masked (GC_MASK) to
+ * keep that bit clear, and the ordered comparisons shift it out before they
+ * compare, so integers are 63 bits wide, wrap around, and divide unsigned.
+ *
+ * The tagged one (make tagged, which defines VM_TAGGED) keeps an integer n
+ * as n << 1 and a heap address as address | 1, which the alignment of cons
+ * cells allows. The sum, the difference and the order of two integers are
+ * then those of their words, a single native instruction each, and the
+ * overflow flag of the add or sub says whether the result still fits. An
+ * integer is a signed 63 bit one, and an operation whose result does not fit
+ * stops the program (VM_OVERFLOW) instead of wrapping around.
+ *
+ * Booleans are the integers 0 and 1 in both.
+ */
+
+#ifdef VM_TAGGED
+
+#define TAG_CELL         (1)
+// from an integer, sign extended to a whole word
+#define IntValue(n)      ( (uintptr_t) (n) << 1 )
+#define ValueInt(v)      ( (intptr_t) (v) >> 1 )
+#define PointsToHeap(v)  ( (v) & TAG_CELL )
+#define CellOf(v)        ( (cons*) ((uintptr_t) (v) - TAG_CELL) )
+#define CellValue(cell)  ( (uintptr_t) (cell) | TAG_CELL )
+// the ordered comparisons, on the words as they are
+#define Compare(a,op,b)  ( (intptr_t) (a) op (intptr_t) (b) )
+
+#else
+
+#define MARK_FAKE        (0x8000000000000000)
+#define IntValue(n)      ( (uintptr_t) (n) & GC_MASK )
+// bit 62 is the sign
+#define ValueInt(v)      ( (intptr_t) ((v) << 1) >> 1 )
+#define PointsToHeap(v)  ( (v) & MARK_FAKE )
+#define CellOf(v)        ( (cons*) ((uintptr_t) (v) & GC_MASK) )
+#define CellValue(cell)  ( (uintptr_t) (cell) | MARK_FAKE )
+// the gc bit is shifted out, which pads with a zero, so the sign is bit 62
+#define Compare(a,op,b)  ( (intptr_t) ((a) << 1) op (intptr_t) ((b) << 1) )
+
+#endif
+
+#endif
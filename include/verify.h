@@ -0,0 +1,56 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "stack.h"
+
+/*
+ * Checks a program before it runs, so that the interpreter (and the JIT) can
+ * go on trusting it without checking anything per instruction. Following
+ * every path from offset 0, it makes sure that
+ *   - every opcode is a known one, and every instruction fits in the program
+ *   - every jump lands on the start of an instruction, or right at the end
+ *     of the program (which halts)
+ *   - the stack never underflows, DUP and SWAP reach only entries that are
+ *     there, and the stack never grows past MAX_STACK_DEPTH
+ *
+ * The last one can only be proven where the stack depth is the same on every
+ * path that gets there, which is not the case for loops that push or pop
+ * (printing a string off the stack, say). The instructions after such a
+ * point get a stack_check instead, and the interpreter checks that the
+ * stack is deep enough before running them (see the CHECK records in threaded.h).
+ *
+ * It runs before fusion, superinstruction opcodes are not valid input.
+ * Returns false, with a message and the offending offset in error, if the
+ * program does not pass. Otherwise *checks is NULL if everything was proven,
+ * or has a stack_check for every offset of the program.
+ */
+
+// data[0] is taken by the interpreter, see handlers.h
+#define MAX_STACK_DEPTH (STACK_SIZE - 1)
+
+struct verify_error
+{
+    size_t pc;
+    char message[128];
+};
+typedef struct verify_error verify_error;
+
+/*
+ * The depth an instruction needs to start with, if needed is set. A stack
+ * that gets too deep is caught as it runs by the guard page (see stack.h).
+ */
+struct stack_check
+{
+    bool needed;
+    uint16_t min;
+};
+typedef struct stack_check stack_check;
+
+bool verifyProgram(const uint8_t* program, size_t length, stack_check** checks,
+                   verify_error* error);
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef VM_H
+#define VM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * The whole virtual machine as a library (libvm.a). A vm_t holds everything
+ * a program needs: its code, stack, heap and garbage collector, the JIT's
+ * native code and the I/O buffers. Nothing is shared between two of them,
+ * so a process can have as many as it likes, each on its own thread.
+ *
+ *     vm_options options = vm_default_options();
+ *     vm_t* vm = vm_create(&options);
+ *     if (!vm || !vm_load(vm, "program.bin"))
+ *         ... vm_error(vm) says why (vm_create() sets errno) ...
+ *     vm_status status = vm_run(vm);
+ *     vm_destroy(vm);
+ *
+ * A single vm_t must only be used by one thread at a time.
+ *
+ * A loaded program (vm_program) on the other hand is only ever read once it
+ * is loaded, so one can be shared by any number of VMs (see vm_attach()),
+ * which is what the batch mode (batch.h) does.
+ */
+
+#define VM_ERROR_SIZE 256
+
+struct vm_options
+{
+    // see the --heap-initial, --heap-max, --grow-threshold and --nursery options
+    size_t heap_size;
+    size_t max_heap_size;
+    size_t nursery_size;
+    double grow_threshold;
+    bool lazy_sweep;
+    // sweep on a thread of its own, see --concurrent-sweep (not with lazy_sweep)
+    bool concurrent_sweep;
+    // threads that mark, see --gc-threads (1 marks on the collecting thread alone)
+    size_t gc_threads;
+    bool fuse;
+    bool jit;
+    // reject programs whose stack depth cannot be proven (see verify.h)
+    bool strict;
+    // where INPUT reads and OUTPUT writes, they are not closed by vm_destroy()
+    int in_fd;
+    int out_fd;
+    bool line_buffered;
+    // collector statistics, written at the end of every vm_run()
+    FILE* gc_stats;
+    const char* gc_stats_json;
+    // where SNAPSHOT writes its image (see snapshot.h), or NULL to ignore it
+    const char* snapshot;
+    // the folded stacks of the sampling profiler (see sampler.h), or NULL not to sample
+    const char* sample;
+    unsigned int sample_rate;
+    // the profiling build only, see profile.h and heapprof.h
+    bool profile_cycles;
+    const char* heap_profile;
+    const char* heap_graph;
+};
+typedef struct vm_options vm_options;
+
+enum vm_status
+{
+    VM_HALTED,          // the program ran HALT, or off its end
+    VM_BAD_OPCODE,      // never happens to a verified program
+    VM_OUT_OF_MEMORY,   // the heap could not grow past max_heap_size
+    VM_STACK_ERROR,     // a stack check failed or the stack overflowed, see vm_error()
+    VM_SNAPSHOT_ERROR,  // SNAPSHOT could not write its image, see vm_error()
+    VM_OVERFLOW,        // an integer did not fit, only in make tagged or make compact
+};
+typedef enum vm_status vm_status;
+
+typedef struct vm vm_t;
+typedef struct vm_program vm_program;
+
+// the defaults of the command line, on stdin and stdout
+vm_options vm_default_options(void);
+// a VM with an empty heap and no program, or NULL (and errno set)
+vm_t* vm_create(const vm_options* options);
+/*
+ * Maps the program at path, verifies and translates it (fuse and strict are
+ * the options that matter). Returns NULL if it cannot be loaded or is
+ * rejected, and says why in error, which holds VM_ERROR_SIZE bytes.
+ */
+vm_program* vm_program_load(const char* path, const vm_options* options, char* error);
+// the same, for a program that is already in memory (it is copied)
+vm_program* vm_program_load_bytes(const uint8_t* bytes, size_t length,
+                                  const vm_options* options, char* error);
+void vm_program_destroy(vm_program* program);
+/*
+ * Runs program from now on, in place of the one before. The program is only
+ * borrowed, it must outlive the VM or the next vm_attach().
+ */
+bool vm_attach(vm_t* vm, vm_program* program);
+// vm_program_load() and vm_attach() in one, the program goes with the VM
+bool vm_load(vm_t* vm, const char* path);
+bool vm_load_bytes(vm_t* vm, const uint8_t* bytes, size_t length);
+/*
+ * Points INPUT and OUTPUT somewhere else, for the next run. Whatever is
+ * still buffered for the old out_fd is written first.
+ */
+bool vm_set_io(vm_t* vm, int in_fd, int out_fd);
+/*
+ * Makes the next vm_run() start where the image at path (written by SNAPSHOT,
+ * for the same program) was taken, with its stack and heap. The program must
+ * be loaded already.
+ */
+bool vm_restore(vm_t* vm, const char* path);
+// runs the loaded program from its start, with an empty stack (or restored)
+vm_status vm_run(vm_t* vm);
+// what the last vm_load() or vm_run() failed on, or ""
+const char* vm_error(const vm_t* vm);
+void vm_destroy(vm_t* vm);
+
+#endif
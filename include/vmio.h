@@ -0,0 +1,73 @@
+#ifndef VMIO_H
+#define VMIO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * The VM's own stdin and stdout, so that INPUT and OUTPUT are a load or a
+ * store into a buffer instead of a locked libc call each.
+ *
+ * Input comes straight from the file when stdin is a regular file (it is
+ * mapped), and from large read()s otherwise. Output is collected and
+ * written when the buffer fills up, before waiting for input (so a prompt
+ * shows up before the program blocks on the answer), at an explicit
+ * vmioFlush() and at exit. A line buffered one also writes after every
+ * newline, for interactive use.
+ *
+ * Everything the VM prints on stdout has to go through here, or it would
+ * come out of order.
+ */
+
+#define VMIO_BUFFER (64*1024)
+
+struct vmio
+{
+    int in_fd;
+    const uint8_t* in;
+    size_t in_pos;
+    size_t in_length;
+    // the read buffer, or NULL if the input is mapped
+    uint8_t* in_buffer;
+    bool in_mapped;
+    bool in_eof;
+
+    int out_fd;
+    uint8_t* out;
+    size_t out_length;
+    bool line_buffered;
+};
+typedef struct vmio vmio_t;
+
+bool vmioInit(vmio_t* io, int in_fd, int out_fd, bool line_buffered);
+// flushes, and starts over on other descriptors with the same buffers
+bool vmioReopen(vmio_t* io, int in_fd, int out_fd);
+// writes out whatever is buffered
+void vmioFlush(vmio_t* io);
+// flushes, and frees the buffers. The descriptors stay open
+void vmioDestroy(vmio_t* io);
+// the slow paths of vmioGetc() and vmioPutc()
+int vmioRefill(vmio_t* io);
+void vmioFull(vmio_t* io, uint8_t c);
+// printf, for the lines the VM prints itself
+void vmioPrintf(vmio_t* io, const char* format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+// the next input byte, or EOF (like getchar)
+static inline int vmioGetc(vmio_t* io)
+{
+    if (io->in_pos < io->in_length)
+        return io->in[io->in_pos++];
+    return vmioRefill(io);
+}
+
+static inline void vmioPutc(vmio_t* io, uint8_t c)
+{
+    if (io->out_length < VMIO_BUFFER - 1 && !(io->line_buffered && c == '\n'))
+        io->out[io->out_length++] = c;
+    else
+        vmioFull(io, c);
+}
+
+#endif
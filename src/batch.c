@@ -0,0 +1,363 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "batch.h"
+#include "gcstats.h"
+
+struct job
+{
+    const char* path;
+    const char* input;
+    const char* output;
+    vm_program* program;
+    uint64_t latency_ns;
+    bool failed;
+};
+
+/*
+ * The jobs a worker still has, jobs[head] to jobs[tail - 1]. The worker
+ * takes them from the back and thieves from the front, under the lock. A
+ * job is milliseconds of work, so the lock is nowhere near hot.
+ */
+struct worker
+{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    size_t* jobs;
+    size_t head;
+    size_t tail;
+    size_t stolen;
+    size_t index;
+    struct batch* batch;
+};
+
+struct batch
+{
+    struct job* jobs;
+    size_t job_count;
+    struct worker* workers;
+    size_t worker_count;
+    const vm_options* options;
+};
+
+static bool takeFrom(struct worker* worker, bool back, size_t* job)
+{
+    pthread_mutex_lock(&worker->lock);
+    const bool found = worker->head < worker->tail;
+    if (found)
+        *job = back ? worker->jobs[--worker->tail] : worker->jobs[worker->head++];
+    pthread_mutex_unlock(&worker->lock);
+    return found;
+}
+
+// the next job for worker, its own if it has any left. False once all are taken
+static bool nextJob(struct worker* worker, size_t* job)
+{
+    if (takeFrom(worker, true, job))
+        return true;
+    const struct batch* batch = worker->batch;
+    for (size_t i = 1; i < batch->worker_count; ++i)
+    {
+        struct worker* victim = &batch->workers[(worker->index + i) % batch->worker_count];
+        if (takeFrom(victim, false, job))
+        {
+            worker->stolen++;
+            return true;
+        }
+    }
+    return false;
+}
+
+static int openFile(const char* path, bool output)
+{
+    if (strcmp(path, "-") == 0)
+        return open("/dev/null", output ? O_WRONLY : O_RDONLY);
+    return output ? open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644) : open(path, O_RDONLY);
+}
+
+static bool runJob(vm_t* vm, struct job* job)
+{
+    const int in  = openFile(job->input, false);
+    const int out = openFile(job->output, true);
+    bool ok = false;
+    if (in < 0 || out < 0)
+        fprintf(stderr, "%s: %s\n", in < 0 ? job->input : job->output, strerror(errno));
+    else if (vm_set_io(vm, in, out) && vm_attach(vm, job->program))
+    {
+        // like the exit status of ./vm
+        const vm_status status = vm_run(vm);
+        ok = status != VM_OUT_OF_MEMORY && status != VM_STACK_ERROR
+             && status != VM_SNAPSHOT_ERROR && status != VM_OVERFLOW;
+        if (vm_error(vm)[0])
+            fprintf(stderr, "%s: %s\n", job->path, vm_error(vm));
+    }
+    else
+        fprintf(stderr, "%s: %s\n", job->path, vm_error(vm));
+    if (in >= 0)
+        close(in);
+    if (out >= 0)
+        close(out);
+    return ok;
+}
+
+static void* work(void* arg)
+{
+    struct worker* worker = arg;
+    const struct batch* batch = worker->batch;
+    vm_t* vm = NULL;
+    size_t index;
+    while (nextJob(worker, &index))
+    {
+        struct job* job = &batch->jobs[index];
+        const uint64_t start = monotonicNs();
+        if (!job->program)
+            job->failed = true;
+        else
+        {
+            if (!vm)
+                vm = vm_create(batch->options);
+            job->failed = !vm || !runJob(vm, job);
+            // a VM that ran out of memory is not fit for another job
+            if (job->failed)
+            {
+                vm_destroy(vm);
+                vm = NULL;
+            }
+        }
+        job->latency_ns = monotonicNs() - start;
+    }
+    vm_destroy(vm);
+    return NULL;
+}
+
+// splits the manifest into jobs, in place. The strings point into text
+static struct job* parseManifest(char* text, size_t* count)
+{
+    size_t size = 256;
+    struct job* jobs = malloc(size*sizeof(struct job));
+    *count = 0;
+    char* save_line;
+    for (char* line = strtok_r(text, "\n", &save_line); jobs && line; line = strtok_r(NULL, "\n", &save_line))
+    {
+        char* save_field;
+        const char* fields[3] = {NULL, "-", "-"};
+        char* field = strtok_r(line, " \t\r", &save_field);
+        if (!field || field[0] == '#')
+            continue;
+        for (int i = 0; i < 3 && field; ++i, field = strtok_r(NULL, " \t\r", &save_field))
+            fields[i] = field;
+        if (*count == size)
+        {
+            size *= 2;
+            struct job* grown = realloc(jobs, size*sizeof(struct job));
+            if (!grown)
+            {
+                free(jobs);
+                return NULL;
+            }
+            jobs = grown;
+        }
+        jobs[(*count)++] = (struct job) { .path = fields[0], .input = fields[1], .output = fields[2] };
+    }
+    return jobs;
+}
+
+static char* readFile(const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if (!file)
+        return NULL;
+    size_t length = 0, size = 4096;
+    char* text = malloc(size);
+    size_t got;
+    while (text && (got = fread(text + length, 1, size - length - 1, file)) > 0)
+    {
+        length += got;
+        if (size - length == 1)
+        {
+            char* grown = realloc(text, 2*size);
+            if (!grown)
+                free(text);
+            text = grown;
+            size *= 2;
+        }
+    }
+    fclose(file);
+    if (text)
+        text[length] = '\0';
+    return text;
+}
+
+// what byPath() sorts, qsort() has no argument for it
+static _Thread_local const struct job* sorting;
+
+static int byPath(const void* a, const void* b)
+{
+    return strcmp(sorting[*(const size_t*) a].path, sorting[*(const size_t*) b].path);
+}
+
+/*
+ * Loads every program once, however many jobs run it. order is left with
+ * the jobs sorted by program, so that the ones with the same program are
+ * next to each other.
+ */
+static vm_program** loadPrograms(struct job* jobs, size_t count, const vm_options* options,
+                                 size_t* order, size_t* program_count)
+{
+    vm_program** programs = calloc(count + 1, sizeof(vm_program*));
+    if (!programs)
+        return NULL;
+    for (size_t i = 0; i < count; ++i)
+        order[i] = i;
+    sorting = jobs;
+    qsort(order, count, sizeof(size_t), byPath);
+
+    *program_count = 0;
+    vm_program* program = NULL;
+    for (size_t i = 0; i < count; ++i)
+    {
+        struct job* job = &jobs[order[i]];
+        if (i == 0 || strcmp(job->path, jobs[order[i - 1]].path) != 0)
+        {
+            char error[VM_ERROR_SIZE];
+            program = vm_program_load(job->path, options, error);
+            if (!program)
+                fprintf(stderr, "%s\n", error);
+            else
+                programs[(*program_count)++] = program;
+        }
+        job->program = program;
+    }
+    return programs;
+}
+
+static int compareU64(const void* a, const void* b)
+{
+    const uint64_t x = *(const uint64_t*) a, y = *(const uint64_t*) b;
+    return (x > y) - (x < y);
+}
+
+// nearest rank, like the pauses in gcstats.c
+static uint64_t percentile(const uint64_t* sorted, size_t count, unsigned int p)
+{
+    if (count == 0)
+        return 0;
+    size_t rank = (count*p + 99) / 100;
+    return sorted[rank ? rank - 1 : 0];
+}
+
+static void reportBatch(const struct batch* batch, uint64_t elapsed_ns, FILE* out)
+{
+    uint64_t* latencies = malloc((batch->job_count + 1)*sizeof(uint64_t));
+    if (!latencies)
+        return;
+    size_t failed = 0, stolen = 0;
+    uint64_t total = 0;
+    for (size_t i = 0; i < batch->job_count; ++i)
+    {
+        failed      += batch->jobs[i].failed;
+        total       += batch->jobs[i].latency_ns;
+        latencies[i] = batch->jobs[i].latency_ns;
+    }
+    for (size_t i = 0; i < batch->worker_count; ++i)
+        stolen += batch->workers[i].stolen;
+    qsort(latencies, batch->job_count, sizeof(uint64_t), compareU64);
+    const size_t count   = batch->job_count;
+    const double seconds = elapsed_ns / 1e9;
+    fprintf(out, "batch: %zu jobs (%zu failed) on %zu workers in %.3f s, %.1f jobs/s\n",
+            count, failed, batch->worker_count, seconds, seconds > 0 ? count / seconds : 0.0);
+    fprintf(out, "batch: latency mean %.3f ms, p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+            count ? total / 1e6 / count : 0.0, percentile(latencies, count, 50) / 1e6,
+            percentile(latencies, count, 90) / 1e6, percentile(latencies, count, 99) / 1e6,
+            count ? latencies[count - 1] / 1e6 : 0.0);
+    fprintf(out, "batch: %zu jobs stolen\n", stolen);
+    free(latencies);
+}
+
+int runBatch(const char* manifest, const vm_options* options, size_t workers, FILE* report)
+{
+    if (workers == 0)
+    {
+        fprintf(stderr, "%s: a batch needs at least one worker\n", manifest);
+        return -1;
+    }
+    const uint64_t start = monotonicNs();
+    char* text = readFile(manifest);
+    if (!text)
+    {
+        perror(manifest);
+        return -1;
+    }
+    struct batch batch = { .options = options };
+    size_t program_count = 0;
+    vm_program** programs = NULL;
+    size_t* dealt = NULL;
+    batch.jobs = parseManifest(text, &batch.job_count);
+    if (batch.jobs)
+        dealt = malloc((batch.job_count + 1)*sizeof(size_t));
+    if (dealt)
+        programs = loadPrograms(batch.jobs, batch.job_count, options, dealt, &program_count);
+    if (workers > batch.job_count)
+        workers = batch.job_count ? batch.job_count : 1;
+    batch.worker_count = workers;
+    batch.workers      = calloc(workers, sizeof(struct worker));
+    if (!batch.jobs || !programs || !batch.workers || !dealt)
+    {
+        fprintf(stderr, "%s: out of memory\n", manifest);
+        free(text);
+        free(batch.jobs);
+        free(programs);
+        free(batch.workers);
+        free(dealt);
+        return -1;
+    }
+
+    /*
+     * Every worker gets a contiguous share of the sorted jobs, so it mostly
+     * runs the same program over and over, and its JIT keeps its code.
+     */
+    size_t next = 0;
+    for (size_t i = 0; i < workers; ++i)
+    {
+        struct worker* worker = &batch.workers[i];
+        const size_t share    = batch.job_count / workers + (i < batch.job_count % workers);
+        worker->jobs  = &dealt[next];
+        worker->head  = 0;
+        worker->tail  = share;
+        worker->index = i;
+        worker->batch = &batch;
+        next         += share;
+        pthread_mutex_init(&worker->lock, NULL);
+    }
+    size_t started = 0;
+    for (; started < workers; ++started)
+        if (pthread_create(&batch.workers[started].thread, NULL, work, &batch.workers[started]) != 0)
+            break;
+    // if not every thread could be started, the ones that did steal the rest
+    if (started == 0)
+        work(&batch.workers[0]);
+    for (size_t i = 0; i < started; ++i)
+        pthread_join(batch.workers[i].thread, NULL);
+
+    reportBatch(&batch, monotonicNs() - start, report);
+    int failed = 0;
+    for (size_t i = 0; i < batch.job_count; ++i)
+        failed += batch.jobs[i].failed;
+    for (size_t i = 0; i < workers; ++i)
+        pthread_mutex_destroy(&batch.workers[i].lock);
+    for (size_t i = 0; i < program_count; ++i)
+        vm_program_destroy(programs[i]);
+    free(programs);
+    free(dealt);
+    free(batch.workers);
+    free(batch.jobs);
+    free(text);
+    return failed;
+}
@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "disasm.h"
+#include "fusion.h"
+#include "instructions.h"
+#include "utils.h"
+
+size_t disassemble(const uint8_t* pc, char* buf, size_t size)
+{
+    void* args = (void*) &pc[1];
+    buf[0]     = '\0';
+    switch (pc[0])
+    {
+        case JUMP:
+            snprintf(buf, size, "JUMP %lx", get2ByteAddress(args));
+            return SIZEOF_JUMP;
+        case JNZ:
+            snprintf(buf, size, "JNZ %lx", get2ByteAddress(args));
+            return SIZEOF_JNZ;
+        case JUMP4:
+            snprintf(buf, size, "JUMP4 %lx", get4ByteAddress(args));
+            return SIZEOF_JUMP4;
+        case JNZ4:
+            snprintf(buf, size, "JNZ4 %lx", get4ByteAddress(args));
+            return SIZEOF_JNZ4;
+        case DUP:
+            snprintf(buf, size, "DUP %x", pc[1]);
+            return SIZEOF_DUP;
+        case SWAP:
+            snprintf(buf, size, "SWAP %x", pc[1]);
+            return SIZEOF_SWAP;
+        case DROP:
+            snprintf(buf, size, "DROP");
+            return SIZEOF_DROP;
+            /* ==================IO OPERATORS===================== */
+        case INPUT:
+            snprintf(buf, size, "INPUT");
+            return SIZEOF_INPUT;
+        case OUTPUT:
+            snprintf(buf, size, "OUTPUT");
+            return SIZEOF_OUTPUT;
+            /* ==================PUSH OPERATORS===================== */
+        case PUSH1:
+            snprintf(buf, size, "PUSH1 %lx", get1Byte(args));
+            return SIZEOF_PUSH1;
+        case PUSH2:
+            snprintf(buf, size, "PUSH2 %lx", get2Byte(args));
+            return SIZEOF_PUSH2;
+        case PUSH4:
+            snprintf(buf, size, "PUSH4 %lx", get4Byte(args));
+            return SIZEOF_PUSH4;
+        case ADD:
+            snprintf(buf, size, "ADD");
+            return SIZEOF_ADD;
+        case SUB:
+            snprintf(buf, size, "SUB");
+            return SIZEOF_SUB;
+        case MUL:
+            snprintf(buf, size, "MUL");
+            return SIZEOF_MUL;
+        case DIV:
+            snprintf(buf, size, "DIV");
+            return SIZEOF_DIV;
+        case MOD:
+            snprintf(buf, size, "MOD");
+            return SIZEOF_MOD;
+            /* =========================COMPARISONS======================= */
+        case EQ:
+            snprintf(buf, size, "EQ");
+            return SIZEOF_EQ;
+        case NE:
+            snprintf(buf, size, "NE");
+            return SIZEOF_NE;
+        case LT:
+            snprintf(buf, size, "LT");
+            return SIZEOF_LT;
+        case GT:
+            snprintf(buf, size, "GT");
+            return SIZEOF_GT;
+        case LE:
+            snprintf(buf, size, "LE");
+            return SIZEOF_LE;
+        case GE:
+            snprintf(buf, size, "GE");
+            return SIZEOF_GE;
+            /* ======================LOGICAL OPERATORS==================== */
+        case NOT:
+            snprintf(buf, size, "NOT");
+            return SIZEOF_NOT;
+        case AND:
+            snprintf(buf, size, "AND");
+            return SIZEOF_AND;
+        case OR:
+            snprintf(buf, size, "OR");
+            return SIZEOF_OR;
+            /* ======================DYNAMIC MEMORY======================= */
+        case CONS:
+            snprintf(buf, size, "CONS");
+            return SIZEOF_CONS;
+        case HD:
+            snprintf(buf, size, "HD");
+            return SIZEOF_HD;
+        case TL:
+            snprintf(buf, size, "TL");
+            return SIZEOF_TL;
+            /* ===========================FINISH========================== */
+        case CLOCK:
+            snprintf(buf, size, "CLOCK");
+            return SIZEOF_CLOCK;
+        case SNAPSHOT:
+            snprintf(buf, size, "SNAPSHOT");
+            return SIZEOF_SNAPSHOT;
+        case HALT:
+            snprintf(buf, size, "HALT");
+            return 1;
+        default:
+            break;
+    }
+    const superinstruction* super = superinstructionOf(pc[0]);
+    if (!super)
+        return 0;
+    // the operands of the first part follow the opcode, as they always did
+    uint8_t first[8] = {super->parts[0]};
+    for (size_t i = 1; i < instructionSize(super->parts[0]); ++i)
+        first[i] = pc[i];
+    const size_t length = disassemble(first, buf, size);
+    snprintf(buf + strlen(buf), size - strlen(buf), " [%s]", super->name);
+    return length;
+}
+
+size_t instructionSize(uint8_t opcode)
+{
+    const superinstruction* super = superinstructionOf(opcode);
+    if (super)
+        return instructionSize(super->parts[0]);
+    char buf[64];
+    // every operand is decoded from zeroes, only the size is wanted
+    uint8_t instruction[8] = {opcode};
+    // several VMs can be loading at once, they all store the same sizes
+    static size_t sizes[256];
+    size_t known = __atomic_load_n(&sizes[opcode], __ATOMIC_RELAXED);
+    if (!known)
+    {
+        known = disassemble(instruction, buf, sizeof(buf));
+        __atomic_store_n(&sizes[opcode], known, __ATOMIC_RELAXED);
+    }
+    return known;
+}
+
+bool isJump(uint8_t opcode)
+{
+    return opcode == JUMP || opcode == JNZ || opcode == JUMP4 || opcode == JNZ4;
+}
+
+size_t jumpTarget(const uint8_t* pc)
+{
+    if (pc[0] == JUMP4 || pc[0] == JNZ4)
+        return get4ByteAddress((void*) &pc[1]);
+    return get2ByteAddress((void*) &pc[1]);
+}
+
+// the longest mnemonic is SNAPSHOT, with room to spare
+#define NAME_SIZE 16
+
+static char           names[256][NAME_SIZE];
+static pthread_once_t names_once = PTHREAD_ONCE_INIT;
+
+static void decodeNames(void)
+{
+    for (int opcode = 0; opcode < 256; ++opcode)
+    {
+        // PUSH1 and friends need a valid operand to decode, a zero will do
+        uint8_t instruction[8] = {opcode};
+        char    line[64];
+        if (superinstructionOf(opcode) || !disassemble(instruction, line, sizeof(line)))
+            continue;
+        const size_t length = strcspn(line, " ");
+        snprintf(names[opcode], NAME_SIZE, "%.*s", (int) length, line);
+    }
+}
+
+const char* opcodeName(uint8_t opcode)
+{
+    const superinstruction* super = superinstructionOf(opcode);
+    if (super)
+        return super->name;
+    pthread_once(&names_once, decodeNames);
+    return names[opcode][0] ? names[opcode] : NULL;
+}
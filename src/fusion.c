@@ -0,0 +1,88 @@
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "fusion.h"
+#include "disasm.h"
+#include "instructions.h"
+#include "utils.h"
+
+static const superinstruction table[] = {
+#define SUPER2(name, opcode, a, b)    {#name, opcode, 2, {a, b}},
+#define SUPER3(name, opcode, a, b, c) {#name, opcode, 3, {a, b, c}},
+#include "superinstructions.h"
+#undef SUPER2
+#undef SUPER3
+};
+#define TABLE_SIZE (sizeof(table)/sizeof(table[0]))
+
+const superinstruction* superinstructionOf(uint8_t opcode)
+{
+    for (size_t i = 0; i < TABLE_SIZE; ++i)
+        if (table[i].opcode == opcode)
+            return &table[i];
+    return NULL;
+}
+
+size_t fuseSuperinstructions(uint8_t* program, size_t length)
+{
+    // 1 for the start of an instruction, 2 for a jump target
+    uint8_t* kind = calloc(length + 1, sizeof(uint8_t));
+    if (!kind)
+        return 0;
+    size_t end = 0;
+    while (end < length)
+    {
+        const size_t size = instructionSize(program[end]);
+        if (size == 0 || end + size > length)
+            break;
+        kind[end] = 1;
+        end      += size;
+    }
+    for (size_t pc = 0; pc < end; pc += instructionSize(program[pc]))
+    {
+        if (!isJump(program[pc]))
+            continue;
+        const size_t target = jumpTarget(&program[pc]);
+        if (target >= end)
+            continue;
+        if (!kind[target])
+        {
+            // a jump into the middle of an instruction, leave it all alone
+            free(kind);
+            return 0;
+        }
+        kind[target] = 2;
+    }
+
+    size_t fused = 0;
+    for (size_t pc = 0; pc < end; pc += instructionSize(program[pc]))
+    {
+        // the longest match wins, a superinstruction is never looked into
+        const superinstruction* best = NULL;
+        for (size_t i = 0; i < TABLE_SIZE; ++i)
+        {
+            const superinstruction* super = &table[i];
+            if (best && best->length >= super->length)
+                continue;
+            size_t part = 0, at = pc;
+            for (; part < super->length && at < end; ++part)
+            {
+                if (program[at] != super->parts[part] || (part > 0 && kind[at] == 2))
+                    break;
+                at += instructionSize(program[at]);
+            }
+            if (part == super->length)
+                best = super;
+        }
+        if (best)
+        {
+            program[pc] = best->opcode;
+            fused++;
+            // the rest of the sequence is skipped over by the handler
+            for (size_t part = 1; part < best->length; ++part)
+                pc += instructionSize(best->parts[part - 1]);
+        }
+    }
+    free(kind);
+    return fused;
+}
@@ -1,78 +1,484 @@
+#include <string.h>
+#include <sys/mman.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 #include "gc.h"
+#include "heapprof.h"
 
-bool markAndSweep(garbage_collector* gc)
+static size_t roundToPages(size_t size)
+{
+    const size_t page = 4096;
+    return (size + page - 1) & ~(page - 1);
+}
+
+/*
+ * Maps a new region of at least min_size bytes (normally as large as the
+ * heap already is, so that it doubles) and puts all of its cells on the
+ * freelist. Returns false if the maximum heap size has been reached.
+ */
+bool growHeap(garbage_collector* gc, size_t min_size)
+{
+    if (gc->region_count == MAX_REGIONS || gc->size >= gc->max_size)
+        return false;
+    size_t size = gc->size > min_size ? gc->size : min_size;
+    size = roundToPages(size);
+    if (size > gc->max_size - gc->size)
+        size = gc->max_size - gc->size;
+
+#ifdef VM_COMPACT
+    // right after the last region, in the reservation made by gcInit()
+    void* heap = mmap((void*) (gc->base + gc->size), size, PROT_READ | PROT_WRITE,
+                      MAP_FIXED | MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+#else
+    // wherever the kernel puts it, every VM in the process has its own heap
+    void* heap = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+#endif
+    if (heap == MAP_FAILED)
+        return false;
+    heap_region* region = &gc->regions[gc->region_count++];
+    region->bottom   = (uintptr_t) heap;
+    region->size     = size;
+    region->bitarray = calloc(BitWords(size/sizeof(cons)), sizeof(uint64_t));
+    gc->size        += size;
+
+    for (size_t i = size; i >= sizeof(cons); i -= sizeof(cons))
+    {
+        cons* temp = (cons*)(region->bottom + i - sizeof(cons));
+        SetNextFree(gc, temp, gc->freelist);
+        gc->freelist = temp;
+        gc->free_cells++;
+    }
+    return true;
+}
+
+void releaseRegion(heap_region* region)
 {
+#ifdef VM_COMPACT
+    // the addresses stay reserved, growHeap() maps them again
+    mmap((void*) region->bottom, region->size, PROT_NONE,
+         MAP_FIXED | MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+#else
+    munmap((void*) region->bottom, region->size);
+#endif
+    free(region->bitarray);
+    region->bitarray = NULL;
+}
+
+bool gcInit(garbage_collector* gc, size_t heap_size, size_t max_heap_size,
+            size_t nursery_size, double grow_threshold)
+{
+    nursery_size       = roundToPages(nursery_size);
+    gc->max_size       = roundToPages(max_heap_size);
+    gc->grow_threshold = grow_threshold;
+#ifdef VM_COMPACT
     /*
-     * the roots array holds the addresses of the cons items,
-     * as they are found on the stack.
+     * A cell word has 32 bits for the offset of a cell from base, so the
+     * heap cannot grow past 4G, nursery included. Only the address space is
+     * taken here, growHeap() maps the regions in it as they are needed.
      */
-    uintptr_t*   roots = malloc(sizeof(uintptr_t)*(gc->size));
-    unsigned int count = 0;
-    // iterate over the stack to find roots
+    const size_t limit = ((size_t) 1 << 32) - nursery_size;
+    if (gc->max_size > limit)
+        gc->max_size = limit;
+    gc->reserved = gc->max_size + nursery_size;
+    void* base   = mmap(NULL, gc->reserved, PROT_NONE,
+                        MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED)
+        return false;
+    gc->base     = (uintptr_t) base;
+#endif
+    if (!growHeap(gc, roundToPages(heap_size)))
+        return false;
+
+    // new cells are bumped out of the nursery, survivors move to the heap
+#ifdef VM_COMPACT
+    gc->nursery        = mmap((void*) (gc->base + gc->max_size), nursery_size, PROT_READ | PROT_WRITE,
+                              MAP_FIXED | MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+#else
+    gc->nursery        = mmap(NULL, nursery_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+#endif
+    if (gc->nursery == MAP_FAILED)
+        return false;
+    gc->nursery_size   = nursery_size;
+    gc->young_ptr      = gc->nursery;
+    gc->young_limit    = gc->nursery + nursery_size/sizeof(cons);
+    gc->young_bitarray = calloc(BitWords(nursery_size/sizeof(cons)), sizeof(uint64_t));
+    gc->promoted       = malloc(nursery_size/sizeof(cons) * sizeof(cons*));
+    return gc->young_bitarray && gc->promoted;
+}
+
+void gcDestroy(garbage_collector* gc)
+{
+    gcSweeperDestroy(gc->sweeper);
+    gcMarkersDestroy(gc->markers);
+#ifdef VM_COMPACT
+    // the regions and the nursery all go with the reservation
+    for (size_t i = 0; i < gc->region_count; ++i)
+        free(gc->regions[i].bitarray);
+    if (gc->base)
+        munmap((void*) gc->base, gc->reserved);
+#else
+    for (size_t i = 0; i < gc->region_count; ++i)
+        releaseRegion(&gc->regions[i]);
+    if (gc->nursery && gc->nursery != MAP_FAILED)
+        munmap(gc->nursery, gc->nursery_size);
+#endif
+    free(gc->young_bitarray);
+    free(gc->promoted);
+    free(gc->remembered);
+    free(gc->mark_stack);
+    gcStatsDestroy(gc->stats);
+}
+
+static void clearMarks(heap_region* region)
+{
+    memset(region->bitarray, 0, BitWords(region->size/sizeof(cons))*sizeof(uint64_t));
+}
+
+/*
+ * Marks the cell value points to, unless it is not a heap address or is
+ * marked already, and pushes it on the mark stack so that its head and tail
+ * get looked at too. Returns true for a newly marked old generation cell.
+ */
+static inline bool markValue(garbage_collector* gc, uintptr_t value, size_t* count)
+{
+    if (!PointsToHeap(value))
+        return false;
+    const uintptr_t cell = (uintptr_t) CellOf(value);
+    size_t index;
+    uint64_t* bitarray = markBitsOf(gc, cell, &index);
+    if (IsMarked(bitarray, index))
+        return false;
+    Mark(bitarray, index);
+    gc->mark_stack[(*count)++] = cell;
+    return bitarray != gc->young_bitarray;
+}
+
+// the mark phase on a single thread, returns how many old cells it marked
+static size_t markFromStack(garbage_collector* gc)
+{
+    size_t count  = 0;
+    size_t marked = 0;
     for (int i = 0; i < gc->machine->top; ++i)
-    {
-        if (PointsToHeap(gc->machine->data[i])){
-            /*
-             * gc->machine->data[i] is an address that has its msb marked.
-             * gc->machine->data[i] & GC_MASK is the actual address of the cons
-             * item in the heap.  In its current form, it cannot be used to
-             * index the bit array.  The bottom address of the heap needs to be
-             * substracted from it.
-             */
-            roots[count++] = gc->machine->data[i];
-        }
-    }
-    // mark: dfs for every root
-    while (count-- != 0)
+        marked += markValue(gc, gc->machine->data[i], &count);
+    // mark: dfs from every root
+    while (count != 0)
     {
         /*
-         * first make sure it points to the heap, then get the address.
+         * Cells in the nursery are not swept, but they have to be traced
+         * through, since they may be the only thing keeping old cells
+         * alive. They get their own bit array.
+         *
+         * The head and the tail are values just like the ones on the stack,
+         * heap addresses among them still have their mark (see DO_CONS()).
          */
-        if (PointsToHeap(roots[count]))
+        const cons* cell = (const cons*) gc->mark_stack[--count];
+        marked += markValue(gc, ValueOf(gc, cell->head), &count);
+        marked += markValue(gc, ValueOf(gc, cell->tail), &count);
+    }
+    return marked;
+}
+
+bool markAndSweep(garbage_collector* gc)
+{
+    const int outer = gc->collecting;
+    gc->collecting  = GC_MAJOR;
+    const size_t cells = (gc->size + gc->nursery_size) / sizeof(cons);
+    const uint64_t start = gc->stats ? monotonicNs() : 0;
+    // the heap may have grown since the last collection
+    if (gc->mark_stack_size < cells)
+    {
+        free(gc->mark_stack);
+        gc->mark_stack      = malloc(cells*sizeof(uintptr_t));
+        gc->mark_stack_size = cells;
+        if (!gc->mark_stack)
         {
-            /*
-             * Here, the bit array is being indexed. Therefore, the bottom
-             * address of the heap (gc->bottom) is substracted from the actual
-             * address (roots[count]).  If it is marked, just go on. Else, mark
-             * it and put it on the dfs stack.
-             */
-            roots[count] &= GC_MASK;
-            if (!IsMarked(gc->bitarray, roots[count] - gc->bottom))
-            {
-                Mark(gc->bitarray, roots[count] - gc->bottom);
-                /*
-                 * there is a crucial point here. The cons address that is being
-                 * used to access the 'head' and 'tail' fields is first found on
-                 * the stack and converted to an actual address. Since it was found
-                 * on the stack, it was a marked address. Therefore, the 'head' and
-                 * 'tail' fields should be marked as well for the algorithm to work.
-                 *
-                 * This must be taken care of in the handling of the 'cons' case in
-                 * the main loop of the machine.
-                 */
-                const uintptr_t temp = roots[count];
-                roots[count++] = ((cons*)temp)->head;
-                roots[count++] = (uintptr_t) ((cons*)temp)->tail;
-            }
+            perror("mark stack");
+            exit(1);
         }
     }
-    free(roots);
+    // the marks are about to be set again, so the sweeper must be done with them
+    if (gc->sweeper)
+        gcSweepWait(gc->sweeper);
+    /*
+     * A lazy sweep from the previous collection may not have reached the
+     * end of the heap. Its leftover marks are stale now, and the free cells
+     * it did not get to will be found by the next sweep anyway.
+     */
+    if (gc->lazy_sweep)
+        for (size_t r = 0; r < gc->region_count; ++r)
+            clearMarks(&gc->regions[r]);
+    gc_event* event = NULL;
+    if (gc->stats)
+    {
+        event = gcStatsEvent(gc->stats, true);
+        for (int i = 0; i < gc->machine->top; ++i)
+            event->roots += PointsToHeap(gc->machine->data[i]) != 0;
+    }
+    const size_t free_before = gc->free_cells;
+    const size_t marked = gc->markers && gc->size/sizeof(cons) >= PARALLEL_MARK_CELLS
+                              ? gcMarkParallel(gc->markers)
+                              : markFromStack(gc);
+    HEAP_PROFILE_MARKED(gc);
     // sweep: go through the heap (the bitarray actually) and add unmarked
     // elements to the freelist
     /* 
      * As a sanity check, one can count the marked elements and the reachable,
      * they should be equal.
+     *
+     * The freelist is rebuilt from scratch, because a major collection can
+     * now be asked for while there still are a few free cells left.
      */
-    for (unsigned int i = 0; i < gc->size; i += sizeof(cons))
+    size_t kept = 0;
+    for (size_t i = 0; i < gc->remembered_count; ++i)
+    {
+        // a remembered cell that died must not be looked at again
+        cons* cell = gc->remembered[i];
+        const heap_region* region = regionOf(gc, (uintptr_t) cell);
+        if (IsMarked(region->bitarray, ((uintptr_t) cell - region->bottom) / sizeof(cons)))
+            gc->remembered[kept++] = cell;
+    }
+    gc->remembered_count = kept;
+
+    gc->freelist      = NULL;
+    gc->free_cells    = gc->size/sizeof(cons) - marked;
+    gc->sweep_region  = 0;
+    gc->sweep_word    = 0;
+    gc->sweep_regions = gc->region_count;
+    uint64_t marked_at = 0;
+    if (event)
+        marked_at = monotonicNs();
+    if (gc->sweeper && !gc->lazy_sweep)
+    {
+        // the regions mapped from here on start out on the freelist
+        gcSweepStart(gc->sweeper, gc->region_count);
+        gc->sweep_region = gc->sweep_regions;
+    }
+    else if (!gc->lazy_sweep)
+        sweepSome(gc, SIZE_MAX);
+    if (gc->young_bitarray)
+        memset(gc->young_bitarray, 0, BitWords(gc->nursery_size/sizeof(cons))*sizeof(uint64_t));
+    if (event)
+    {
+        event->mark_ns   = marked_at - start;
+        event->sweep_ns  = monotonicNs() - marked_at;
+        event->marked    = marked;
+        event->reclaimed = gc->free_cells - free_before;
+    }
+    /*
+     * If most of the heap is still alive, the next collection will come
+     * soon and free little, so ask for more room now.
+     */
+    const size_t live = marked*sizeof(cons);
+    if (live > gc->grow_threshold * gc->size)
+        growHeap(gc, 0);
+    gc->collecting = outer;
+    return gc->free_cells;
+}
+
+/*
+ * Returns the first word in [from, to) that has an unmarked cell in it, or
+ * to. After a collection that found most of the heap alive, this is where
+ * the sweep spends its time, so it looks at several words at once when the
+ * compiler lets it.
+ */
+static size_t skipMarkedWords(const uint64_t* bits, size_t from, size_t to)
+{
+#if defined(__AVX2__)
+    const __m256i ones = _mm256_set1_epi64x(-1);
+    for (; from + 4 <= to; from += 4)
+        if (!_mm256_testc_si256(_mm256_loadu_si256((const __m256i*) &bits[from]), ones))
+            break;
+#elif defined(__SSE2__)
+    const __m128i ones = _mm_set1_epi64x(-1);
+    for (; from + 2 <= to; from += 2)
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*) &bits[from]), ones)) != 0xFFFF)
+            break;
+#endif
+    while (from < to && bits[from] == UINT64_MAX)
+        from++;
+    return from;
+}
+
+cons* sweepWords(garbage_collector* gc, const heap_region* region, size_t start, size_t end,
+                 cons** last)
+{
+    uint64_t* bits  = region->bitarray;
+    cons*     first = NULL;
+    *last = NULL;
+    for (size_t w = skipMarkedWords(bits, start, end); w < end; w = skipMarkedWords(bits, w + 1, end))
+    {
+        // every set bit of free is a cell to give back, lowest first
+        for (uint64_t free = ~bits[w]; free; free &= free - 1)
+        {
+            const size_t k = w*64 + __builtin_ctzll(free);
+            cons* temp = (cons*)(region->bottom + k*sizeof(cons));
+            SetNextFree(gc, temp, first);
+            first = temp;
+            if (!*last)
+                *last = temp;
+        }
+    }
+    // the marks of the swept words are not needed any more
+    memset(&bits[start], 0, (end - start)*sizeof(uint64_t));
+    return first;
+}
+
+/*
+ * Sweeps at most max_cells cells (rounded up to a whole word of the bit
+ * array), starting where the last call stopped, and adds the unmarked ones
+ * to the freelist. Only the regions that existed when marking finished are
+ * swept: a region mapped after that starts out on the freelist already.
+ * Returns false when there is nothing left to sweep.
+ */
+bool sweepSome(garbage_collector* gc, size_t max_cells)
+{
+    size_t max_words = BitWords(max_cells);
+    while (gc->sweep_region < gc->sweep_regions)
+    {
+        const heap_region* region = &gc->regions[gc->sweep_region];
+        const size_t words = BitWords(region->size/sizeof(cons));
+        const size_t start = gc->sweep_word;
+        size_t end = words;
+        if (end - start > max_words)
+            end = start + max_words;
+        cons* last;
+        cons* first = sweepWords(gc, region, start, end, &last);
+        if (first)
+        {
+            SetNextFree(gc, last, gc->freelist);
+            gc->freelist = first;
+        }
+        max_words     -= end - start;
+        gc->sweep_word = end;
+        if (end == words)
+        {
+            gc->sweep_region++;
+            gc->sweep_word = 0;
+        }
+        if (max_words == 0)
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Copies a young cell to the old generation, leaving a forwarding pointer
+ * behind, and replaces *value with the new address. Anything that is not a
+ * nursery address is left untouched. Returns false if the old generation
+ * ran out of cells.
+ */
+static bool promote(garbage_collector* gc, uintptr_t* value, size_t* gray)
+{
+    if (!PointsToHeap(*value) || !InNursery(gc, CellOf(*value)))
+        return true;
+    cons* young = CellOf(*value);
+    if (young->tail != FORWARDED)
+    {
+        /*
+         * With lazy sweeping, the freelist running dry only means that the
+         * sweep has to go on for a while. With a concurrent sweep, it means
+         * taking what the sweeper has found since, or waiting for it.
+         */
+        while (!gc->freelist)
+        {
+            const uint64_t start = gc->stats ? monotonicNs() : 0;
+            bool more = sweepSome(gc, LAZY_SWEEP_CHUNK);
+            if (!more && gc->sweeper)
+                more = (gc->freelist = gcSweepTake(gc->sweeper)) != NULL;
+            if (gc->stats)
+                gc->stats->lazy_sweep_ns += monotonicNs() - start;
+            if (!more && !gc->freelist)
+                return false;
+        }
+        cons* old     = gc->freelist;
+        gc->freelist  = NextFree(gc, gc->freelist);
+        gc->free_cells--;
+        *old          = *young;
+        HEAP_PROFILE_PROMOTE(gc, young, old);
+        young->head   = WordOf(gc, CellValue(old));
+        young->tail   = FORWARDED;
+        gc->promoted[(*gray)++] = old;
+    }
+    *value = ValueOf(gc, young->head);
+    return true;
+}
+
+static bool promoteFields(garbage_collector* gc, cons* cell, size_t* gray)
+{
+    uintptr_t head = ValueOf(gc, cell->head);
+    uintptr_t tail = ValueOf(gc, cell->tail);
+    if (!promote(gc, &head, gray) || !promote(gc, &tail, gray))
+        return false;
+    // only references change, and those always fit
+    cell->head = WordOf(gc, head);
+    cell->tail = WordOf(gc, tail);
+    return true;
+}
+
+/*
+ * Cheney style minor collection, except that the to-space is the old
+ * generation's freelist, so the scan order is kept in gc->promoted. Every
+ * survivor is promoted, which means the work done is proportional to what
+ * is alive in the nursery and not to its size.
+ */
+bool minorCollect(garbage_collector* gc)
+{
+    gc->collecting = GC_MINOR;
+    const size_t young_cells = gc->young_ptr - gc->nursery;
+    /*
+     * In the worst case everything in the nursery survives. If the old
+     * generation cannot take that, collect it first. This is the only place
+     * where a major collection happens.
+     */
+    if (gc->free_cells < young_cells)
+        markAndSweep(gc);
+    if (gc->free_cells < young_cells)
+        growHeap(gc, (young_cells - gc->free_cells)*sizeof(cons));
+
+    gc_event* event = NULL;
+    uint64_t  start = 0;
+    if (gc->stats)
+    {
+        event            = gcStatsEvent(gc->stats, false);
+        event->allocated = young_cells*sizeof(cons);
+        for (int i = 0; i < gc->machine->top; ++i)
+            event->roots += PointsToHeap(gc->machine->data[i]) != 0;
+        start            = monotonicNs();
+    }
+
+    size_t gray = 0, scan = 0;
+    bool   ok   = true;
+    for (int i = 0; ok && i < gc->machine->top; ++i)
+        ok = promote(gc, &gc->machine->data[i], &gray);
+    for (size_t i = 0; ok && i < gc->remembered_count; ++i)
+        ok = promoteFields(gc, gc->remembered[i], &gray);
+    gc->remembered_count = 0;
+    while (ok && scan < gray)
+        ok = promoteFields(gc, gc->promoted[scan++], &gray);
+    gc->young_ptr = gc->nursery;
+    if (event)
+    {
+        event->mark_ns   = monotonicNs() - start;
+        event->marked    = gray;
+        event->reclaimed = young_cells - gray;
+    }
+    gc->collecting = 0;
+    return ok;
+}
+
+void rememberCell(garbage_collector* gc, cons* cell)
+{
+    if (gc->remembered_count == gc->remembered_size)
     {
-        if (IsMarked(gc->bitarray, i))
-            Unmark(gc->bitarray, i);
-        else
+        gc->remembered_size = gc->remembered_size ? 2*gc->remembered_size : 64;
+        gc->remembered      = realloc(gc->remembered, gc->remembered_size*sizeof(cons*));
+        if (!gc->remembered)
         {
-            cons* temp = (cons*)(gc->bottom + i);
-            temp->head = (uintptr_t) gc->freelist;
-            gc->freelist = temp;
+            perror("remembered set");
+            exit(1);
         }
     }
-    return gc->freelist;
+    gc->remembered[gc->remembered_count++] = cell;
 }
@@ -0,0 +1,331 @@
+// signal.h has a stack_t of its own, the one of sigaltstack()
+#define stack_t signal_stack_t
+#include <signal.h>
+#undef stack_t
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "gc.h"
+
+// entries in a deque, a power of two
+#define DEQUE_SIZE 4096
+// no cell is at address 0
+#define EMPTY      ((uintptr_t) 0)
+
+/*
+ * Chase and Lev's deque, with the memory orders of Le et al., "Correct and
+ * Efficient Work-Stealing for Weak Memory Models". It never grows: a push
+ * that does not fit goes to the shared overflow instead.
+ */
+struct deque
+{
+    _Atomic int64_t top;
+    // the owner's end, on a cache line of its own
+    _Alignas(64) _Atomic int64_t bottom;
+    _Alignas(64) _Atomic uintptr_t items[DEQUE_SIZE];
+};
+
+struct marker
+{
+    struct deque deque;
+    gc_markers* all;
+    size_t index;
+    // old generation cells this one marked
+    size_t marked;
+    pthread_t thread;
+};
+
+struct gc_markers
+{
+    garbage_collector* gc;
+    // markers[0] is the thread that collects, the others are helpers
+    struct marker* markers;
+    size_t count;
+    // the helpers wait for epoch to change, the collector for finished to reach count - 1
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    uint64_t epoch;
+    size_t finished;
+    bool quit;
+    // markers that found nothing to do, see mark()
+    _Atomic size_t idle;
+    // what did not fit in a deque, on gc->mark_stack
+    pthread_mutex_t overflow_lock;
+    _Atomic size_t overflow_count;
+};
+
+static bool push(struct deque* d, uintptr_t cell)
+{
+    const int64_t b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    const int64_t t = atomic_load_explicit(&d->top, memory_order_acquire);
+    if (b - t >= DEQUE_SIZE)
+        return false;
+    atomic_store_explicit(&d->items[b & (DEQUE_SIZE - 1)], cell, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    return true;
+}
+
+// the owner's end
+static uintptr_t take(struct deque* d)
+{
+    const int64_t b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t t = atomic_load_explicit(&d->top, memory_order_relaxed);
+    uintptr_t cell = EMPTY;
+    if (t <= b)
+    {
+        cell = atomic_load_explicit(&d->items[b & (DEQUE_SIZE - 1)], memory_order_relaxed);
+        if (t != b)
+            return cell;
+        // the last one, which a thief may be after as well
+        if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1, memory_order_seq_cst,
+                                                     memory_order_relaxed))
+            cell = EMPTY;
+    }
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    return cell;
+}
+
+// the other end, EMPTY as well if another thief got there first
+static uintptr_t steal(struct deque* d)
+{
+    int64_t t = atomic_load_explicit(&d->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    const int64_t b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+    if (t >= b)
+        return EMPTY;
+    const uintptr_t cell = atomic_load_explicit(&d->items[t & (DEQUE_SIZE - 1)], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1, memory_order_seq_cst,
+                                                 memory_order_relaxed))
+        return EMPTY;
+    return cell;
+}
+
+static void overflow(gc_markers* all, uintptr_t cell)
+{
+    pthread_mutex_lock(&all->overflow_lock);
+    const size_t count = atomic_load_explicit(&all->overflow_count, memory_order_relaxed);
+    all->gc->mark_stack[count] = cell;
+    atomic_store_explicit(&all->overflow_count, count + 1, memory_order_relaxed);
+    pthread_mutex_unlock(&all->overflow_lock);
+}
+
+static uintptr_t fromOverflow(gc_markers* all)
+{
+    if (atomic_load_explicit(&all->overflow_count, memory_order_relaxed) == 0)
+        return EMPTY;
+    uintptr_t cell = EMPTY;
+    pthread_mutex_lock(&all->overflow_lock);
+    const size_t count = atomic_load_explicit(&all->overflow_count, memory_order_relaxed);
+    if (count)
+    {
+        cell = all->gc->mark_stack[count - 1];
+        atomic_store_explicit(&all->overflow_count, count - 1, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&all->overflow_lock);
+    return cell;
+}
+
+/*
+ * Like markValue() in gc.c, except that the bit is set atomically, since two
+ * markers may reach the same cell (or two cells of the same word) at once.
+ * Only the one that set the bit pushes the cell.
+ */
+static void markValue(struct marker* m, uintptr_t value)
+{
+    if (!PointsToHeap(value))
+        return;
+    garbage_collector* gc = m->all->gc;
+    const uintptr_t cell = (uintptr_t) CellOf(value);
+    size_t index;
+    uint64_t* bitarray = markBitsOf(gc, cell, &index);
+    uint64_t* word = &bitarray[index/64];
+    const uint64_t bit = (uint64_t) 1 << (index % 64);
+    // most of the cells reached twice are marked already, and a load is cheaper
+    if (__atomic_load_n(word, __ATOMIC_RELAXED) & bit
+        || __atomic_fetch_or(word, bit, __ATOMIC_RELAXED) & bit)
+        return;
+    m->marked += bitarray != gc->young_bitarray;
+    // its head and tail are read when it is taken, which is usually soon after
+    __builtin_prefetch((const void*) cell);
+    if (!push(&m->deque, cell))
+        overflow(m->all, cell);
+}
+
+static uintptr_t findWork(struct marker* m)
+{
+    gc_markers* all = m->all;
+    uintptr_t cell = take(&m->deque);
+    if (cell == EMPTY)
+        cell = fromOverflow(all);
+    for (size_t i = 1; cell == EMPTY && i < all->count; ++i)
+        cell = steal(&all->markers[(m->index + i) % all->count].deque);
+    return cell;
+}
+
+static bool workLeft(gc_markers* all)
+{
+    if (atomic_load(&all->overflow_count) != 0)
+        return true;
+    for (size_t i = 0; i < all->count; ++i)
+    {
+        struct deque* d = &all->markers[i].deque;
+        if (atomic_load(&d->top) < atomic_load(&d->bottom))
+            return true;
+    }
+    return false;
+}
+
+/*
+ * A marker only goes idle with its own deque empty, and only a marker that
+ * is not idle pushes anything. So once they are all idle, there is nothing
+ * left anywhere and there never will be.
+ */
+static void mark(struct marker* m)
+{
+    gc_markers* all = m->all;
+    for (;;)
+    {
+        uintptr_t cell;
+        while ((cell = findWork(m)) != EMPTY)
+        {
+            const cons* c = (const cons*) cell;
+            markValue(m, ValueOf(all->gc, c->head));
+            markValue(m, ValueOf(all->gc, c->tail));
+        }
+        atomic_fetch_add(&all->idle, 1);
+        for (;;)
+        {
+            if (atomic_load(&all->idle) == all->count)
+                return;
+            if (workLeft(all))
+                break;
+            sched_yield();
+        }
+        atomic_fetch_sub(&all->idle, 1);
+    }
+}
+
+static void* helper(void* arg)
+{
+    struct marker* m   = arg;
+    gc_markers*    all = m->all;
+    uint64_t       seen = 0;
+    pthread_mutex_lock(&all->lock);
+    for (;;)
+    {
+        while (all->epoch == seen && !all->quit)
+            pthread_cond_wait(&all->start, &all->lock);
+        if (all->quit)
+            break;
+        seen = all->epoch;
+        pthread_mutex_unlock(&all->lock);
+        mark(m);
+        pthread_mutex_lock(&all->lock);
+        if (++all->finished == all->count - 1)
+            pthread_cond_signal(&all->done);
+    }
+    pthread_mutex_unlock(&all->lock);
+    return NULL;
+}
+
+gc_markers* gcMarkersCreate(garbage_collector* gc, size_t count)
+{
+    gc_markers* all = calloc(1, sizeof(gc_markers));
+    if (!all)
+        return NULL;
+    // a whole number of cache lines, since struct marker is aligned to one
+    all->markers = aligned_alloc(64, count*sizeof(struct marker));
+    if (!all->markers)
+    {
+        free(all);
+        return NULL;
+    }
+    memset(all->markers, 0, count*sizeof(struct marker));
+    all->gc = gc;
+    pthread_mutex_init(&all->lock, NULL);
+    pthread_mutex_init(&all->overflow_lock, NULL);
+    pthread_cond_init(&all->start, NULL);
+    pthread_cond_init(&all->done, NULL);
+    all->count = 1;
+    all->markers[0].all = all;
+    // the helpers inherit a blocked SIGPROF, so the sampler's ticks go to the VM thread
+    sigset_t profiling, mask;
+    sigemptyset(&profiling);
+    sigaddset(&profiling, SIGPROF);
+    pthread_sigmask(SIG_BLOCK, &profiling, &mask);
+    for (size_t i = 1; i < count; ++i)
+    {
+        all->markers[i].all   = all;
+        all->markers[i].index = i;
+        if (pthread_create(&all->markers[i].thread, NULL, helper, &all->markers[i]) != 0)
+            break;
+        all->count++;
+    }
+    pthread_sigmask(SIG_SETMASK, &mask, NULL);
+    if (all->count < count)
+    {
+        gcMarkersDestroy(all);
+        return NULL;
+    }
+    return all;
+}
+
+void gcMarkersDestroy(gc_markers* all)
+{
+    if (!all)
+        return;
+    pthread_mutex_lock(&all->lock);
+    all->quit = true;
+    pthread_cond_broadcast(&all->start);
+    pthread_mutex_unlock(&all->lock);
+    for (size_t i = 1; i < all->count; ++i)
+        pthread_join(all->markers[i].thread, NULL);
+    pthread_mutex_destroy(&all->lock);
+    pthread_mutex_destroy(&all->overflow_lock);
+    pthread_cond_destroy(&all->start);
+    pthread_cond_destroy(&all->done);
+    free(all->markers);
+    free(all);
+}
+
+size_t gcMarkParallel(gc_markers* all)
+{
+    garbage_collector* gc = all->gc;
+    for (size_t i = 0; i < all->count; ++i)
+    {
+        all->markers[i].marked = 0;
+        atomic_store(&all->markers[i].deque.top, 0);
+        atomic_store(&all->markers[i].deque.bottom, 0);
+    }
+    atomic_store(&all->overflow_count, 0);
+    atomic_store(&all->idle, 0);
+    // the roots are dealt out to the deques while the helpers still sleep
+    for (int i = 0; i < gc->machine->top; ++i)
+        markValue(&all->markers[i % all->count], gc->machine->data[i]);
+
+    pthread_mutex_lock(&all->lock);
+    all->epoch++;
+    all->finished = 0;
+    pthread_cond_broadcast(&all->start);
+    pthread_mutex_unlock(&all->lock);
+    mark(&all->markers[0]);
+    pthread_mutex_lock(&all->lock);
+    while (all->finished < all->count - 1)
+        pthread_cond_wait(&all->done, &all->lock);
+    pthread_mutex_unlock(&all->lock);
+
+    size_t marked = 0;
+    for (size_t i = 0; i < all->count; ++i)
+        marked += all->markers[i].marked;
+    return marked;
+}
@@ -0,0 +1,148 @@
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <sys/resource.h>
+
+#include "gcstats.h"
+
+gc_stats* gcStatsCreate(void)
+{
+    gc_stats* stats = calloc(1, sizeof(gc_stats));
+    if (!stats)
+        err(1, "gc stats");
+    stats->start_ns = monotonicNs();
+    return stats;
+}
+
+void gcStatsDestroy(gc_stats* stats)
+{
+    if (stats)
+        free(stats->events);
+    free(stats);
+}
+
+gc_event* gcStatsEvent(gc_stats* stats, bool major)
+{
+    if (stats->count == stats->size)
+    {
+        stats->size   = stats->size ? 2*stats->size : 256;
+        stats->events = realloc(stats->events, stats->size*sizeof(gc_event));
+        if (!stats->events)
+            err(1, "gc stats");
+    }
+    gc_event* event = &stats->events[stats->count++];
+    memset(event, 0, sizeof(gc_event));
+    event->major = major;
+    return event;
+}
+
+/*
+ * Everything the two reports print, worked out once. Pauses are a single
+ * collection each, so a major collection started by a minor one counts as
+ * two pauses.
+ */
+struct summary
+{
+    size_t majors;
+    uint64_t mark_ns, sweep_ns;
+    uint64_t p50, p99, max;
+    size_t roots, marked, reclaimed, allocated;
+    uint64_t runtime_ns;
+    // of the whole process, not just the heap
+    size_t peak_rss;
+};
+
+static int compareU64(const void* a, const void* b)
+{
+    const uint64_t x = *(const uint64_t*) a, y = *(const uint64_t*) b;
+    return (x > y) - (x < y);
+}
+
+// nearest rank percentile of a sorted array
+static uint64_t percentile(const uint64_t* sorted, size_t count, unsigned int p)
+{
+    if (count == 0)
+        return 0;
+    size_t rank = (count*p + 99) / 100;
+    return sorted[rank ? rank - 1 : 0];
+}
+
+static struct summary summarize(const gc_stats* stats, size_t allocated)
+{
+    struct summary sum = {0};
+    uint64_t* pauses   = malloc((stats->count + 1)*sizeof(uint64_t));
+    if (!pauses)
+        err(1, "gc stats");
+    for (size_t i = 0; i < stats->count; ++i)
+    {
+        const gc_event* event = &stats->events[i];
+        sum.majors    += event->major;
+        sum.mark_ns   += event->mark_ns;
+        sum.sweep_ns  += event->sweep_ns;
+        sum.roots     += event->roots;
+        sum.marked    += event->marked;
+        sum.reclaimed += event->reclaimed;
+        sum.allocated += event->allocated;
+        pauses[i]      = event->mark_ns + event->sweep_ns;
+    }
+    qsort(pauses, stats->count, sizeof(uint64_t), compareU64);
+    sum.p50        = percentile(pauses, stats->count, 50);
+    sum.p99        = percentile(pauses, stats->count, 99);
+    sum.max        = stats->count ? pauses[stats->count - 1] : 0;
+    sum.allocated += allocated;
+    sum.runtime_ns = monotonicNs() - stats->start_ns;
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+        sum.peak_rss = (size_t) usage.ru_maxrss * 1024; // it is in KB
+    free(pauses);
+    return sum;
+}
+
+void gcStatsReport(const gc_stats* stats, size_t allocated, size_t heap_size, FILE* out)
+{
+    const struct summary sum = summarize(stats, allocated);
+    const double seconds     = sum.runtime_ns / 1e9;
+    fprintf(out, "gc: %zu collections (%zu minor, %zu major), heap is %zu bytes\n",
+            stats->count, stats->count - sum.majors, sum.majors, heap_size);
+    fprintf(out, "gc: mark/copy %.3f ms, sweep %.3f ms, lazy sweep %.3f ms, run %.3f ms\n",
+            sum.mark_ns / 1e6, sum.sweep_ns / 1e6, stats->lazy_sweep_ns / 1e6, sum.runtime_ns / 1e6);
+    fprintf(out, "gc: pause p50 %.3f us, p99 %.3f us, max %.3f us\n",
+            sum.p50 / 1e3, sum.p99 / 1e3, sum.max / 1e3);
+    fprintf(out, "gc: %zu roots, %zu cells marked or promoted, %zu reclaimed\n",
+            sum.roots, sum.marked, sum.reclaimed);
+    fprintf(out, "gc: %zu bytes allocated, %.1f MB/s\n",
+            sum.allocated, seconds > 0 ? sum.allocated / seconds / 1e6 : 0.0);
+    fprintf(out, "gc: peak rss %zu bytes (the whole process)\n", sum.peak_rss);
+}
+
+void gcStatsJson(const gc_stats* stats, size_t allocated, size_t heap_size, FILE* out)
+{
+    const struct summary sum = summarize(stats, allocated);
+    const double seconds     = sum.runtime_ns / 1e9;
+    fprintf(out, "{\n");
+    fprintf(out, "  \"collections\": %zu,\n", stats->count);
+    fprintf(out, "  \"minor_collections\": %zu,\n", stats->count - sum.majors);
+    fprintf(out, "  \"major_collections\": %zu,\n", sum.majors);
+    fprintf(out, "  \"heap_bytes\": %zu,\n", heap_size);
+    fprintf(out, "  \"runtime_ns\": %lu,\n", sum.runtime_ns);
+    fprintf(out, "  \"mark_ns\": %lu,\n", sum.mark_ns);
+    fprintf(out, "  \"sweep_ns\": %lu,\n", sum.sweep_ns);
+    fprintf(out, "  \"lazy_sweep_ns\": %lu,\n", stats->lazy_sweep_ns);
+    fprintf(out, "  \"pause_ns\": {\"p50\": %lu, \"p99\": %lu, \"max\": %lu},\n", sum.p50, sum.p99, sum.max);
+    fprintf(out, "  \"roots\": %zu,\n", sum.roots);
+    fprintf(out, "  \"cells_marked\": %zu,\n", sum.marked);
+    fprintf(out, "  \"cells_reclaimed\": %zu,\n", sum.reclaimed);
+    fprintf(out, "  \"allocated_bytes\": %zu,\n", sum.allocated);
+    fprintf(out, "  \"allocation_rate_bytes_per_s\": %.0f,\n", seconds > 0 ? sum.allocated / seconds : 0.0);
+    fprintf(out, "  \"peak_rss_bytes\": %zu,\n", sum.peak_rss);
+    fprintf(out, "  \"events\": [");
+    for (size_t i = 0; i < stats->count; ++i)
+    {
+        const gc_event* event = &stats->events[i];
+        fprintf(out, "%s\n    {\"kind\": \"%s\", \"mark_ns\": %lu, \"sweep_ns\": %lu, \"roots\": %zu, "
+                "\"marked\": %zu, \"reclaimed\": %zu, \"allocated_bytes\": %zu}",
+                i ? "," : "", event->major ? "major" : "minor", event->mark_ns, event->sweep_ns,
+                event->roots, event->marked, event->reclaimed, event->allocated);
+    }
+    fprintf(out, "%s]\n}\n", stats->count ? "\n  " : "");
+}
@@ -0,0 +1,168 @@
+// signal.h has a stack_t of its own, the one of sigaltstack()
+#define stack_t signal_stack_t
+#include <signal.h>
+#undef stack_t
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "gc.h"
+
+struct gc_sweeper
+{
+    garbage_collector* gc;
+    pthread_t thread;
+    /*
+     * The sweeper waits on start for epoch to change, and whoever wants the
+     * sweep to be over (or more cells) on swept.
+     */
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t swept;
+    uint64_t epoch;
+    size_t regions;
+    bool sweeping;
+    _Atomic bool quit;
+    // the lists of swept cells, chained through their last cells
+    _Atomic(cons*) published;
+    // set while the allocator waits on swept, so that a push wakes it
+    _Atomic bool waiting;
+};
+
+static void publish(gc_sweeper* s, cons* first, cons* last)
+{
+    cons* top = atomic_load_explicit(&s->published, memory_order_relaxed);
+    do
+        SetNextFree(s->gc, last, top);
+    while (!atomic_compare_exchange_weak(&s->published, &top, first));
+    if (atomic_load(&s->waiting))
+    {
+        pthread_mutex_lock(&s->lock);
+        pthread_cond_broadcast(&s->swept);
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+static void sweepRegions(gc_sweeper* s, size_t count)
+{
+    garbage_collector* gc = s->gc;
+    for (size_t r = 0; r < count; ++r)
+    {
+        const heap_region* region = &gc->regions[r];
+        const size_t words = BitWords(region->size/sizeof(cons));
+        for (size_t start = 0, end; start < words; start = end)
+        {
+            if (atomic_load_explicit(&s->quit, memory_order_relaxed))
+                return;
+            end = start + SWEEP_SEGMENT < words ? start + SWEEP_SEGMENT : words;
+            cons* last;
+            cons* first = sweepWords(gc, region, start, end, &last);
+            if (first)
+                publish(s, first, last);
+        }
+    }
+}
+
+static void* sweeper(void* arg)
+{
+    gc_sweeper* s    = arg;
+    uint64_t    seen = 0;
+    pthread_mutex_lock(&s->lock);
+    for (;;)
+    {
+        while (s->epoch == seen && !s->quit)
+            pthread_cond_wait(&s->start, &s->lock);
+        if (s->quit)
+            break;
+        seen = s->epoch;
+        const size_t regions = s->regions;
+        pthread_mutex_unlock(&s->lock);
+        sweepRegions(s, regions);
+        pthread_mutex_lock(&s->lock);
+        s->sweeping = false;
+        pthread_cond_broadcast(&s->swept);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+gc_sweeper* gcSweeperCreate(garbage_collector* gc)
+{
+    gc_sweeper* s = calloc(1, sizeof(gc_sweeper));
+    if (!s)
+        return NULL;
+    s->gc = gc;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->start, NULL);
+    pthread_cond_init(&s->swept, NULL);
+    // like the marker helpers (see gcmark.c), the sweeper leaves SIGPROF to the VM thread
+    sigset_t profiling, mask;
+    sigemptyset(&profiling);
+    sigaddset(&profiling, SIGPROF);
+    pthread_sigmask(SIG_BLOCK, &profiling, &mask);
+    const int created = pthread_create(&s->thread, NULL, sweeper, s);
+    pthread_sigmask(SIG_SETMASK, &mask, NULL);
+    if (created != 0)
+    {
+        pthread_mutex_destroy(&s->lock);
+        pthread_cond_destroy(&s->start);
+        pthread_cond_destroy(&s->swept);
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+void gcSweeperDestroy(gc_sweeper* s)
+{
+    if (!s)
+        return;
+    pthread_mutex_lock(&s->lock);
+    s->quit = true;
+    pthread_cond_signal(&s->start);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->thread, NULL);
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->start);
+    pthread_cond_destroy(&s->swept);
+    free(s);
+}
+
+void gcSweepStart(gc_sweeper* s, size_t regions)
+{
+    pthread_mutex_lock(&s->lock);
+    s->regions  = regions;
+    s->sweeping = true;
+    s->epoch++;
+    pthread_cond_signal(&s->start);
+    pthread_mutex_unlock(&s->lock);
+}
+
+cons* gcSweepTake(gc_sweeper* s)
+{
+    cons* cells = atomic_exchange(&s->published, NULL);
+    if (cells)
+        return cells;
+    /*
+     * The sweeper pushes before it looks at waiting, and this sets waiting
+     * before it looks at the stack again, so one of the two sees the other.
+     */
+    pthread_mutex_lock(&s->lock);
+    atomic_store(&s->waiting, true);
+    while (!(cells = atomic_exchange(&s->published, NULL)) && s->sweeping)
+        pthread_cond_wait(&s->swept, &s->lock);
+    atomic_store(&s->waiting, false);
+    pthread_mutex_unlock(&s->lock);
+    return cells;
+}
+
+void gcSweepWait(gc_sweeper* s)
+{
+    pthread_mutex_lock(&s->lock);
+    while (s->sweeping)
+        pthread_cond_wait(&s->swept, &s->lock);
+    pthread_mutex_unlock(&s->lock);
+    atomic_store(&s->published, NULL);
+}
@@ -0,0 +1,431 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "heapprof.h"
+#include "disasm.h"
+
+// the sites named on the line written after every major collection
+#define TOP_SITES 5
+
+bool heapProfileInit(heap_profile_t* profile, const garbage_collector* gc,
+                     const uint8_t* program, size_t length, const char* path, const char* graph)
+{
+    memset(profile, 0, sizeof(heap_profile_t));
+    profile->program = program;
+    profile->length  = length;
+    profile->graph   = graph;
+    profile->sites   = calloc(length + 1, sizeof(heap_site));
+    profile->young   = calloc(gc->nursery_size/sizeof(cons), sizeof(heap_tag));
+    profile->out     = strcmp(path, "-") == 0 ? stderr : fopen(path, "w");
+    if (profile->sites && profile->young && profile->out)
+        return true;
+    const int saved = errno;
+    heapProfileDestroy(profile);
+    errno = saved;
+    return false;
+}
+
+void heapProfileDestroy(heap_profile_t* profile)
+{
+    free(profile->sites);
+    free(profile->young);
+    for (size_t i = 0; i < MAX_REGIONS; ++i)
+        free(profile->tags[i]);
+    if (profile->out && profile->out != stderr)
+        fclose(profile->out);
+    memset(profile, 0, sizeof(heap_profile_t));
+}
+
+/*
+ * The tags of a region, made the first time they are needed. A region the
+ * tags were not made for (snapshot.c replaces them all) gets new ones, of
+ * unknown origin.
+ */
+static heap_tag* regionTags(heap_profile_t* profile, const heap_region* region, size_t i)
+{
+    if (!profile->tags[i] || profile->bottoms[i] != region->bottom || profile->sizes[i] != region->size)
+    {
+        free(profile->tags[i]);
+        profile->tags[i] = calloc(region->size/sizeof(cons), sizeof(heap_tag));
+        if (!profile->tags[i])
+        {
+            perror("heap profile");
+            exit(1);
+        }
+        profile->bottoms[i] = region->bottom;
+        profile->sizes[i]   = region->size;
+    }
+    return profile->tags[i];
+}
+
+heap_tag* heapProfileTag(heap_profile_t* profile, garbage_collector* gc, uintptr_t cell)
+{
+    if (InNursery(gc, cell))
+        return &profile->young[(cell - (uintptr_t) gc->nursery)/sizeof(cons)];
+    for (size_t i = 0; i < gc->region_count; ++i)
+    {
+        const heap_region* region = &gc->regions[i];
+        if (cell - region->bottom < region->size)
+            return &regionTags(profile, region, i)[(cell - region->bottom)/sizeof(cons)];
+    }
+    return NULL;
+}
+
+static void printSite(FILE* out, size_t site)
+{
+    if (site)
+        fprintf(out, "%lx", site - 1);
+    else
+        fprintf(out, "?");
+}
+
+void heapProfileMarked(heap_profile_t* profile, garbage_collector* gc)
+{
+    uint64_t total = 0;
+    for (size_t s = 0; s <= profile->length; ++s)
+        profile->sites[s].live = 0;
+    for (size_t r = 0; r < gc->region_count; ++r)
+    {
+        const heap_region* region = &gc->regions[r];
+        heap_tag* tags = regionTags(profile, region, r);
+        const size_t words = BitWords(region->size/sizeof(cons));
+        for (size_t w = 0; w < words; ++w)
+            for (uint64_t live = region->bitarray[w]; live; live &= live - 1)
+            {
+                heap_tag*  tag  = &tags[w*64 + __builtin_ctzll(live)];
+                heap_site* site = &profile->sites[tag->site];
+                if (tag->age < UINT32_MAX)
+                    tag->age++;
+                if (tag->age > site->oldest)
+                    site->oldest = tag->age;
+                site->live++;
+                site->survivals++;
+                total++;
+            }
+    }
+    // the young cells the marking went through are alive as well
+    const size_t young = gc->young_ptr - gc->nursery;
+    for (size_t k = 0; k < young; ++k)
+        if (IsMarked(gc->young_bitarray, k))
+        {
+            profile->sites[profile->young[k].site].live++;
+            total++;
+        }
+
+    size_t top[TOP_SITES];
+    size_t count = 0;
+    for (size_t s = 0; s <= profile->length; ++s)
+    {
+        heap_site* site = &profile->sites[s];
+        if (site->live > site->peak)
+            site->peak = site->live;
+        if (!site->live)
+            continue;
+        // insertion into the few largest so far
+        size_t i = count < TOP_SITES ? count++ : TOP_SITES;
+        for (; i > 0 && profile->sites[top[i - 1]].live < site->live; --i)
+            if (i < TOP_SITES)
+                top[i] = top[i - 1];
+        if (i < TOP_SITES)
+            top[i] = s;
+    }
+    profile->collections++;
+    fprintf(profile->out, "major %zu: %lu live cells, at", profile->collections, total);
+    for (size_t i = 0; i < count; ++i)
+    {
+        fprintf(profile->out, " ");
+        printSite(profile->out, top[i]);
+        fprintf(profile->out, " %lu", profile->sites[top[i]].live);
+    }
+    fprintf(profile->out, "\n");
+}
+
+/*
+ * Every cell of the heap has a number: the regions' cells come one after
+ * the other, then the nursery's. The walk below keeps its state in arrays
+ * indexed by it.
+ */
+struct heap_walk
+{
+    garbage_collector* gc;
+    heap_profile_t* profile;
+    size_t first[MAX_REGIONS + 1];
+    size_t cells;
+    /*
+     * How each cell was first reached: 0 if it was not, 2*i + 1 from the
+     * stack entry i, 2*(n + 1) from the cell numbered n.
+     */
+    uint64_t* parent;
+    size_t* queue;
+    // a cell's site, or rather its row and column in edges (and sites's index in it)
+    uint32_t* dense;
+    size_t* sites;
+    size_t site_count;
+    uint64_t* edges;
+    uint64_t* reached;
+    // the first cell of each site the walk got to, which has the shortest path
+    size_t* nearest;
+};
+
+static size_t numberOf(const struct heap_walk* walk, uintptr_t cell)
+{
+    const garbage_collector* gc = walk->gc;
+    if (InNursery(gc, cell))
+        return walk->first[gc->region_count] + (cell - (uintptr_t) gc->nursery)/sizeof(cons);
+    for (size_t i = 0; i < gc->region_count; ++i)
+        if (cell - gc->regions[i].bottom < gc->regions[i].size)
+            return walk->first[i] + (cell - gc->regions[i].bottom)/sizeof(cons);
+    return SIZE_MAX;
+}
+
+static uintptr_t cellOf(const struct heap_walk* walk, size_t n)
+{
+    const garbage_collector* gc = walk->gc;
+    size_t i = 0;
+    while (i < gc->region_count && n >= walk->first[i + 1])
+        ++i;
+    const uintptr_t bottom = i < gc->region_count ? gc->regions[i].bottom : (uintptr_t) gc->nursery;
+    return bottom + (n - walk->first[i])*sizeof(cons);
+}
+
+/*
+ * The cell a value refers to, or 0. Out of memory, a minor collection may
+ * have stopped halfway, with young cells already moved out and forwarded.
+ */
+static uintptr_t referred(const struct heap_walk* walk, uintptr_t value)
+{
+    if (!PointsToHeap(value))
+        return 0;
+    const cons* cell = CellOf(value);
+    if (InNursery(walk->gc, cell) && cell->tail == FORWARDED)
+        cell = CellOf(ValueOf(walk->gc, cell->head));
+    return (uintptr_t) cell;
+}
+
+static uint32_t siteOf(struct heap_walk* walk, uintptr_t cell)
+{
+    return walk->dense[heapProfileTag(walk->profile, walk->gc, cell)->site];
+}
+
+static void reach(struct heap_walk* walk, uintptr_t value, uint64_t parent, size_t from,
+                  size_t* tail)
+{
+    const uintptr_t cell = referred(walk, value);
+    const size_t    n    = cell ? numberOf(walk, cell) : SIZE_MAX;
+    if (n == SIZE_MAX)
+        return;
+    const uint32_t site = siteOf(walk, cell);
+    walk->edges[from*walk->site_count + site]++;
+    if (walk->parent[n])
+        return;
+    walk->parent[n] = parent;
+    walk->queue[(*tail)++] = n;
+    if (!walk->reached[site]++)
+        walk->nearest[site] = n;
+}
+
+// breadth first from the stack, so that the paths found are the shortest
+static void walkHeap(struct heap_walk* walk)
+{
+    garbage_collector* gc = walk->gc;
+    size_t head = 0, tail = 0;
+    // the stack is the last row of edges
+    for (int i = 0; i < gc->machine->top; ++i)
+        reach(walk, gc->machine->data[i], 2*(uint64_t) i + 1, walk->site_count, &tail);
+    while (head < tail)
+    {
+        const size_t    n    = walk->queue[head++];
+        const cons*     cell = (const cons*) cellOf(walk, n);
+        const uint32_t  from = siteOf(walk, (uintptr_t) cell);
+        reach(walk, ValueOf(gc, cell->head), 2*((uint64_t) n + 1), from, &tail);
+        reach(walk, ValueOf(gc, cell->tail), 2*((uint64_t) n + 1), from, &tail);
+    }
+}
+
+struct path_run
+{
+    size_t site;
+    size_t count;
+};
+
+// from the stack to the cell numbered n, with the cells of a site in a row counted once
+static void printPath(FILE* out, const struct heap_walk* walk, size_t n)
+{
+    struct path_run* runs = NULL;
+    size_t count = 0, size = 0;
+    uint64_t parent = 2*((uint64_t) n + 1);
+    while (!(parent & 1))
+    {
+        const size_t m    = parent/2 - 1;
+        const size_t site = walk->sites[walk->dense[heapProfileTag(walk->profile, walk->gc,
+                                                                   cellOf(walk, m))->site]];
+        if (count && runs[count - 1].site == site)
+            runs[count - 1].count++;
+        else
+        {
+            if (count == size)
+            {
+                size = size ? 2*size : 16;
+                struct path_run* more = realloc(runs, size*sizeof(struct path_run));
+                if (!more)
+                {
+                    fprintf(out, "    (out of memory)\n");
+                    free(runs);
+                    return;
+                }
+                runs = more;
+            }
+            runs[count++] = (struct path_run) { site, 1 };
+        }
+        parent = walk->parent[m];
+    }
+    fprintf(out, "    stack[%lu]", parent/2);
+    while (count--)
+    {
+        fprintf(out, " -> ");
+        printSite(out, runs[count].site);
+        if (runs[count].count > 1)
+            fprintf(out, " x%lu", runs[count].count);
+    }
+    fprintf(out, "\n");
+    free(runs);
+}
+
+// what the comparison below sorts by, qsort() has no argument for it
+static _Thread_local const struct heap_walk* sorting;
+
+static int byReached(const void* a, const void* b)
+{
+    const uint64_t x = sorting->reached[*(const uint32_t*) a];
+    const uint64_t y = sorting->reached[*(const uint32_t*) b];
+    return (x < y) - (x > y);
+}
+
+static void writeGraph(const struct heap_walk* walk, const char* path)
+{
+    FILE* out = fopen(path, "w");
+    if (!out)
+    {
+        perror(path);
+        return;
+    }
+    const heap_profile_t* profile = walk->profile;
+    char line[64];
+    fprintf(out, "digraph heap {\n");
+    fprintf(out, "    stack [shape=box];\n");
+    for (size_t d = 0; d < walk->site_count; ++d)
+    {
+        const size_t site = walk->sites[d];
+        if (!walk->reached[d])
+            continue;
+        if (site == 0 || !disassemble(&profile->program[site - 1], line, sizeof(line)))
+            snprintf(line, sizeof(line), "?");
+        fprintf(out, "    \"");
+        printSite(out, site);
+        fprintf(out, "\" [label=\"");
+        printSite(out, site);
+        fprintf(out, ": %s\\n%lu cells\"];\n", line, walk->reached[d]);
+    }
+    for (size_t from = 0; from <= walk->site_count; ++from)
+        for (size_t to = 0; to < walk->site_count; ++to)
+        {
+            const uint64_t count = walk->edges[from*walk->site_count + to];
+            if (!count)
+                continue;
+            if (from == walk->site_count)
+                fprintf(out, "    stack -> \"");
+            else
+            {
+                fprintf(out, "    \"");
+                printSite(out, walk->sites[from]);
+                fprintf(out, "\" -> \"");
+            }
+            printSite(out, walk->sites[to]);
+            fprintf(out, "\" [label=\"%lu\"];\n", count);
+        }
+    fprintf(out, "}\n");
+    fclose(out);
+}
+
+void heapProfileReport(heap_profile_t* profile, garbage_collector* gc)
+{
+    FILE* out = profile->out;
+    struct heap_walk walk = { .gc = gc, .profile = profile };
+    for (size_t i = 0; i < gc->region_count; ++i)
+        walk.first[i + 1] = walk.first[i] + gc->regions[i].size/sizeof(cons);
+    walk.cells = walk.first[gc->region_count] + gc->nursery_size/sizeof(cons);
+
+    // only the sites that ever made a cell get a row, and the unknown one
+    walk.dense = calloc(profile->length + 1, sizeof(uint32_t));
+    walk.sites = malloc((profile->length + 1)*sizeof(size_t));
+    if (walk.dense && walk.sites)
+        for (size_t s = 0; s <= profile->length; ++s)
+            if (s == 0 || profile->sites[s].allocated)
+            {
+                walk.dense[s] = walk.site_count;
+                walk.sites[walk.site_count++] = s;
+            }
+    walk.parent  = calloc(walk.cells, sizeof(uint64_t));
+    walk.queue   = malloc(walk.cells*sizeof(size_t));
+    walk.edges   = calloc((walk.site_count + 1)*walk.site_count, sizeof(uint64_t));
+    walk.reached = calloc(walk.site_count, sizeof(uint64_t));
+    walk.nearest = calloc(walk.site_count, sizeof(size_t));
+    uint32_t* order = malloc(walk.site_count*sizeof(uint32_t));
+    if (!walk.dense || !walk.sites || !walk.parent || !walk.queue || !walk.edges
+        || !walk.reached || !walk.nearest || !order)
+    {
+        fprintf(out, "heap profile: out of memory for the report\n");
+        goto done;
+    }
+    walkHeap(&walk);
+
+    for (size_t d = 0; d < walk.site_count; ++d)
+        order[d] = d;
+    sorting = &walk;
+    qsort(order, walk.site_count, sizeof(uint32_t), byReached);
+
+    char line[64];
+    fprintf(out, "\n==================================== HEAP SITES ====================================\n");
+    fprintf(out, "%6s %12s %12s %12s %12s %14s %7s  %s\n", "site", "allocated", "promoted",
+            "reachable", "peak live", "survivals", "oldest", "instruction");
+    for (size_t i = 0; i < walk.site_count; ++i)
+    {
+        const size_t     s    = walk.sites[order[i]];
+        const heap_site* site = &profile->sites[s];
+        if (!site->allocated && !walk.reached[order[i]])
+            continue;
+        if (s == 0 || !disassemble(&profile->program[s - 1], line, sizeof(line)))
+            snprintf(line, sizeof(line), "?");
+        char name[24] = "?";
+        if (s)
+            snprintf(name, sizeof(name), "%lx", s - 1);
+        fprintf(out, "%6s", name);
+        fprintf(out, " %12lu %12lu %12lu %12lu %14lu %7u  %s\n", site->allocated, site->promoted,
+                walk.reached[order[i]], site->peak, site->survivals, site->oldest, line);
+    }
+
+    fprintf(out, "\n================================= RETENTION PATHS ==================================\n");
+    for (size_t i = 0; i < walk.site_count; ++i)
+    {
+        const size_t d = order[i];
+        if (!walk.reached[d])
+            break;
+        printSite(out, walk.sites[d]);
+        fprintf(out, ": %lu cells reachable, the nearest through\n", walk.reached[d]);
+        printPath(out, &walk, walk.nearest[d]);
+    }
+    fflush(out);
+    if (profile->graph)
+        writeGraph(&walk, profile->graph);
+done:
+    free(order);
+    free(walk.dense);
+    free(walk.sites);
+    free(walk.parent);
+    free(walk.queue);
+    free(walk.edges);
+    free(walk.reached);
+    free(walk.nearest);
+}
@@ -0,0 +1,982 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <sys/mman.h>
+
+#include "jit.h"
+#include "instructions.h"
+#include "stack.h"
+#include "cons.h"
+
+#define JIT_MEMORY   (1 << 20)
+// the most records compiled at once
+#define MAX_REGION   512
+// the most stack entries kept in registers
+#define MAX_CACHED   7
+// the label of the shared exit code
+#define EPILOGUE     MAX_REGION
+
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+// condition codes, for jcc and setcc
+enum { CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF };
+
+/*
+ * While the native code runs:
+ *   rbx  points at the (free) top of the stack in memory
+ *   r12  is the jit_t, r13 the stack machine (stack_t, not its data)
+ *   rax and rdx are scratch, the registers below cache the top of the stack
+ * rax, rdx and the cache registers are all caller saved, the cache is
+ * written back to memory before calling into C.
+ */
+static const uint8_t cache_registers[MAX_CACHED] = { RCX, RSI, RDI, R8, R9, R10, R11 };
+
+// a stack entry that is not in memory (yet), either a register or a constant
+struct value
+{
+    bool constant;
+    uint8_t reg;
+    uintptr_t imm;
+};
+
+struct fixup
+{
+    size_t position; // of the rel32 to patch
+    size_t label;    // a record of the region, or EPILOGUE
+};
+
+struct compiler
+{
+    uint8_t* code;
+    size_t length;
+    size_t size;
+    bool failed;
+
+    const instruction* program;
+    const vmio_t* io;
+    size_t start;
+    size_t end;
+    // the records jumps inside the region go to, they start with an empty cache
+    bool is_label[MAX_REGION];
+    size_t positions[MAX_REGION + 1];
+    struct fixup fixups[2*MAX_REGION + 2];
+    size_t fixup_count;
+
+    // the cached top of the stack, bottom first
+    struct value cache[MAX_CACHED];
+    int cached;
+    // the top of the stack in memory is at rbx + 8*offset
+    int offset;
+    // a bit for every register that is free to cache a value in
+    uint16_t free;
+};
+
+/* =========================== the C side of CONS/HD/TL ======================== */
+
+// these return false if the program cannot go on, see jitBackEdge()
+static bool jitCons(jit_t* jit)
+{
+    garbage_collector* gc = jit->gc;
+    stack_t* stack = gc->machine;
+    if (gc->young_ptr == gc->young_limit && !minorCollect(gc))
+    {
+        vmioPrintf(jit->io, "Memory has been exhausted.\n");
+        return false;
+    }
+    cons* cell = gc->young_ptr++;
+    // neither of these is masked, see DO_CONS()
+    const uintptr_t tail = stack->data[--stack->top];
+    WriteBarrier(gc, cell, tail);
+    cell->tail = WordOf(gc, tail);
+    const uintptr_t head = stack->data[--stack->top];
+    WriteBarrier(gc, cell, head);
+    cell->head = WordOf(gc, head);
+    stackPush(stack, CellValue(cell));
+    return true;
+}
+
+static bool jitHd(jit_t* jit)
+{
+    stack_t* stack = jit->gc->machine;
+    const cons* cell = CellOf(stack->data[stack->top - 1]);
+    stack->data[stack->top - 1] = ValueOf(jit->gc, cell->head);
+    return true;
+}
+
+static bool jitTl(jit_t* jit)
+{
+    stack_t* stack = jit->gc->machine;
+    const cons* cell = CellOf(stack->data[stack->top - 1]);
+    stack->data[stack->top - 1] = ValueOf(jit->gc, cell->tail);
+    return true;
+}
+
+/* ================================ encoding ================================== */
+
+static void emit8(struct compiler* c, uint8_t byte)
+{
+    if (c->length == c->size)
+    {
+        c->size = c->size ? 2*c->size : 4096;
+        uint8_t* code = realloc(c->code, c->size);
+        if (!code)
+        {
+            c->failed = true;
+            c->length = 0;
+            return;
+        }
+        c->code = code;
+    }
+    c->code[c->length++] = byte;
+}
+
+static void emit32(struct compiler* c, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+        emit8(c, value >> 8*i);
+}
+
+static void emit64(struct compiler* c, uint64_t value)
+{
+    for (int i = 0; i < 8; ++i)
+        emit8(c, value >> 8*i);
+}
+
+static bool fits8(int64_t value)
+{
+    return value == (int8_t) value;
+}
+
+static bool fits32(uintptr_t value)
+{
+    return (int64_t) value == (int32_t) value;
+}
+
+/*
+ * The REX prefix. byte is for the instructions that use the low byte of
+ * a register, which needs a REX for sil and dil.
+ */
+static void rex(struct compiler* c, bool wide, int reg, int rm, bool byte)
+{
+    const uint8_t prefix = 0x40 | wide << 3 | (reg >> 3) << 2 | (rm >> 3);
+    if (prefix != 0x40 || (byte && rm >= RSP))
+        emit8(c, prefix);
+}
+
+// op reg, rm (or op rm, reg, depending on the opcode) on two registers
+static void regReg(struct compiler* c, uint8_t op, int reg, int rm)
+{
+    rex(c, true, reg, rm, false);
+    emit8(c, op);
+    emit8(c, 0xC0 | (reg & 7) << 3 | (rm & 7));
+}
+
+// op with a register and [base + disp]. base must not be rsp
+static void regMem(struct compiler* c, uint8_t op, int reg, int base, int32_t disp)
+{
+    rex(c, true, reg, base, false);
+    emit8(c, op);
+    emit8(c, (fits8(disp) ? 0x40 : 0x80) | (reg & 7) << 3 | (base & 7));
+    // r12 as a base needs a SIB byte
+    if ((base & 7) == RSP)
+        emit8(c, 0x24);
+    if (fits8(disp))
+        emit8(c, disp);
+    else
+        emit32(c, disp);
+}
+
+static void movRegReg(struct compiler* c, int dst, int src)
+{
+    regReg(c, 0x89, src, dst);
+}
+
+static void load(struct compiler* c, int dst, int base, int32_t disp)
+{
+    regMem(c, 0x8B, dst, base, disp);
+}
+
+static void store(struct compiler* c, int base, int32_t disp, int src)
+{
+    regMem(c, 0x89, src, base, disp);
+}
+
+static void movImm(struct compiler* c, int dst, uintptr_t imm)
+{
+    if (fits32(imm))
+    {
+        rex(c, true, 0, dst, false);
+        emit8(c, 0xC7);
+        emit8(c, 0xC0 | (dst & 7));
+        emit32(c, imm);
+    }
+    else
+    {
+        rex(c, true, 0, dst, false);
+        emit8(c, 0xB8 | (dst & 7));
+        emit64(c, imm);
+    }
+}
+
+// add, or, and, sub, xor, cmp with an immediate, by their /digit
+enum { ALU_ADD = 0, ALU_OR = 1, ALU_AND = 4, ALU_SUB = 5, ALU_XOR = 6, ALU_CMP = 7 };
+
+static void aluImm(struct compiler* c, int digit, int dst, int32_t imm)
+{
+    rex(c, true, 0, dst, false);
+    emit8(c, fits8(imm) ? 0x83 : 0x81);
+    emit8(c, 0xC0 | digit << 3 | (dst & 7));
+    if (fits8(imm))
+        emit8(c, imm);
+    else
+        emit32(c, imm);
+}
+
+// the same, register to register
+static void aluReg(struct compiler* c, int digit, int dst, int src)
+{
+    regReg(c, digit << 3 | 0x01, src, dst);
+}
+
+static void test(struct compiler* c, int a, int b)
+{
+    regReg(c, 0x85, b, a);
+}
+
+static void imul(struct compiler* c, int dst, int src)
+{
+    rex(c, true, dst, src, false);
+    emit8(c, 0x0F);
+    emit8(c, 0xAF);
+    emit8(c, 0xC0 | (dst & 7) << 3 | (src & 7));
+}
+
+// unsigned rdx:rax / src
+static void divide(struct compiler* c, int src)
+{
+    rex(c, true, 0, src, false);
+    emit8(c, 0xF7);
+    emit8(c, 0xC0 | 6 << 3 | (src & 7));
+}
+
+static void shl1(struct compiler* c, int reg)
+{
+    rex(c, true, 0, reg, false);
+    emit8(c, 0xD1);
+    emit8(c, 0xC0 | 4 << 3 | (reg & 7));
+}
+
+// clears the gc bit, like & GC_MASK
+static void mask(struct compiler* c, int reg)
+{
+    rex(c, true, 0, reg, false);
+    emit8(c, 0x0F);
+    emit8(c, 0xBA);
+    emit8(c, 0xC0 | 6 << 3 | (reg & 7));
+    emit8(c, 63);
+}
+
+// reg = condition ? 1 : 0
+static void setcc(struct compiler* c, int cc, int reg)
+{
+    rex(c, false, 0, reg, true);
+    emit8(c, 0x0F);
+    emit8(c, 0x90 | cc);
+    emit8(c, 0xC0 | (reg & 7));
+    // movzx reg32, reg8
+    rex(c, false, reg, reg, true);
+    emit8(c, 0x0F);
+    emit8(c, 0xB6);
+    emit8(c, 0xC0 | (reg & 7) << 3 | (reg & 7));
+}
+
+static void jumpTo(struct compiler* c, size_t label)
+{
+    emit8(c, 0xE9);
+    c->fixups[c->fixup_count++] = (struct fixup) { c->length, label };
+    emit32(c, 0);
+}
+
+static void branchTo(struct compiler* c, int cc, size_t label)
+{
+    emit8(c, 0x0F);
+    emit8(c, 0x80 | cc);
+    c->fixups[c->fixup_count++] = (struct fixup) { c->length, label };
+    emit32(c, 0);
+}
+
+/*
+ * A jump over the code that follows, to wherever land() is called. cc is a
+ * condition code, or -1 for an unconditional jump.
+ */
+static size_t jumpForward(struct compiler* c, int cc)
+{
+    if (cc < 0)
+        emit8(c, 0xE9);
+    else
+    {
+        emit8(c, 0x0F);
+        emit8(c, 0x80 | cc);
+    }
+    emit32(c, 0);
+    return c->length;
+}
+
+static void land(struct compiler* c, size_t jump)
+{
+    const int32_t distance = c->length - jump;
+    if (!c->failed)
+        memcpy(&c->code[jump - 4], &distance, 4);
+}
+
+// the stack machine's top = (rbx - data) / 8
+static void storeTop(struct compiler* c)
+{
+    movRegReg(c, RAX, RBX);
+    // sub rax, [r13 + data]
+    regMem(c, 0x2B, RAX, R13, offsetof(stack_t, data));
+    // shr rax, 3
+    emit8(c, 0x48);
+    emit8(c, 0xC1);
+    emit8(c, 0xE8);
+    emit8(c, 3);
+    // mov [r13 + top], eax
+    emit8(c, 0x41);
+    emit8(c, 0x89);
+    emit8(c, 0x85);
+    emit32(c, offsetof(stack_t, top));
+}
+
+// rbx = &data[top]
+static void loadTop(struct compiler* c)
+{
+    // movsxd rax, [r13 + top]
+    regMem(c, 0x63, RAX, R13, offsetof(stack_t, top));
+    load(c, RBX, R13, offsetof(stack_t, data));
+    // lea rbx, [rbx + rax*8]
+    emit8(c, 0x48);
+    emit8(c, 0x8D);
+    emit8(c, 0x1C);
+    emit8(c, 0xC3);
+}
+
+/* ============================ the register stack ============================ */
+
+static void storeValue(struct compiler* c, struct value value, int32_t disp)
+{
+    if (!value.constant)
+    {
+        store(c, RBX, disp, value.reg);
+        c->free |= 1 << value.reg;
+    }
+    else if (fits32(value.imm))
+    {
+        // mov qword [rbx + disp], imm32
+        regMem(c, 0xC7, 0, RBX, disp);
+        emit32(c, value.imm);
+    }
+    else
+    {
+        movImm(c, RAX, value.imm);
+        store(c, RBX, disp, RAX);
+    }
+}
+
+// moves the bottom of the cache to memory
+static void spill(struct compiler* c)
+{
+    storeValue(c, c->cache[0], 8*c->offset);
+    c->offset++;
+    c->cached--;
+    memmove(&c->cache[0], &c->cache[1], c->cached*sizeof(struct value));
+}
+
+static int allocate(struct compiler* c)
+{
+    while (1)
+    {
+        for (int i = 0; i < MAX_CACHED; ++i)
+            if (c->free & (1 << cache_registers[i]))
+            {
+                c->free &= ~(1 << cache_registers[i]);
+                return cache_registers[i];
+            }
+        spill(c);
+    }
+}
+
+static void release(struct compiler* c, struct value value)
+{
+    if (!value.constant)
+        c->free |= 1 << value.reg;
+}
+
+static void push(struct compiler* c, struct value value)
+{
+    if (c->cached == MAX_CACHED)
+        spill(c);
+    c->cache[c->cached++] = value;
+}
+
+static void pushRegister(struct compiler* c, int reg)
+{
+    push(c, (struct value) { .constant = false, .reg = reg });
+}
+
+static struct value pop(struct compiler* c)
+{
+    if (c->cached > 0)
+        return c->cache[--c->cached];
+    const int reg = allocate(c);
+    load(c, reg, RBX, 8*(c->offset - 1));
+    c->offset--;
+    return (struct value) { .constant = false, .reg = reg };
+}
+
+// makes sure the value is in a register of its own
+static struct value materialize(struct compiler* c, struct value value)
+{
+    if (!value.constant)
+        return value;
+    const int reg = allocate(c);
+    movImm(c, reg, value.imm);
+    return (struct value) { .constant = false, .reg = reg };
+}
+
+// loads entries from memory until the top n are cached
+static void pull(struct compiler* c, int n)
+{
+    while (c->cached < n)
+    {
+        const int reg = allocate(c);
+        load(c, reg, RBX, 8*(c->offset - 1));
+        c->offset--;
+        memmove(&c->cache[1], &c->cache[0], c->cached*sizeof(struct value));
+        c->cache[0] = (struct value) { .constant = false, .reg = reg };
+        c->cached++;
+    }
+}
+
+// writes the cache back, so that rbx is the top of the stack again
+static void flush(struct compiler* c)
+{
+    for (int i = 0; i < c->cached; ++i)
+        storeValue(c, c->cache[i], 8*(c->offset + i));
+    c->offset += c->cached;
+    c->cached = 0;
+    if (c->offset != 0)
+        regMem(c, 0x8D, RBX, RBX, 8*c->offset);
+    c->offset = 0;
+}
+
+/* ============================== instructions ================================ */
+
+static bool inRegion(const struct compiler* c, const instruction* target)
+{
+    const size_t index = target - c->program;
+    return index >= c->start && index < c->end;
+}
+
+// leaves the native code for the interpreter, which goes on from target
+static void exitTo(struct compiler* c, const instruction* target)
+{
+    movImm(c, RDX, (uintptr_t) target);
+    jumpTo(c, EPILOGUE);
+}
+
+static void callOut(struct compiler* c, bool (*function)(jit_t*), bool can_fail)
+{
+    flush(c);
+    storeTop(c);
+    movRegReg(c, RDI, R12);
+    movImm(c, RAX, (uintptr_t) function);
+    // call rax
+    emit8(c, 0xFF);
+    emit8(c, 0xD0);
+    if (!can_fail)
+    {
+        loadTop(c);
+        return;
+    }
+    // test al, al, before loadTop() needs rax (it leaves the flags alone)
+    emit8(c, 0x84);
+    emit8(c, 0xC0);
+    loadTop(c);
+    const size_t ok = jumpForward(c, CC_NE);
+    exitTo(c, NULL);
+    land(c, ok);
+}
+
+static void compileArithmetic(struct compiler* c, uint8_t opcode)
+{
+    struct value b = pop(c);
+    struct value a = materialize(c, pop(c));
+    switch (opcode)
+    {
+        case ADD:
+        case SUB:
+            if (b.constant && fits32(b.imm))
+                aluImm(c, opcode == ADD ? ALU_ADD : ALU_SUB, a.reg, b.imm);
+            else
+            {
+                b = materialize(c, b);
+                aluReg(c, opcode == ADD ? ALU_ADD : ALU_SUB, a.reg, b.reg);
+            }
+            break;
+        case MUL:
+            b = materialize(c, b);
+            imul(c, a.reg, b.reg);
+            break;
+        case DIV:
+        case MOD:
+            b = materialize(c, b);
+            movRegReg(c, RAX, a.reg);
+            // xor edx, edx
+            emit8(c, 0x31);
+            emit8(c, 0xD2);
+            divide(c, b.reg);
+            movRegReg(c, a.reg, opcode == DIV ? RAX : RDX);
+            break;
+    }
+    mask(c, a.reg);
+    release(c, b);
+    push(c, a);
+}
+
+static void compileComparison(struct compiler* c, uint8_t opcode)
+{
+    struct value b = pop(c);
+    struct value a = materialize(c, pop(c));
+    // the ordered comparisons are signed, once the gc bit is shifted out
+    const bool ordered = opcode != EQ && opcode != NE;
+    if (ordered)
+        shl1(c, a.reg);
+    const uintptr_t imm = ordered ? b.imm << 1 : b.imm;
+    if (b.constant && fits32(imm))
+        aluImm(c, ALU_CMP, a.reg, imm);
+    else
+    {
+        b = materialize(c, b);
+        if (ordered)
+            shl1(c, b.reg);
+        aluReg(c, ALU_CMP, a.reg, b.reg);
+    }
+    int cc = CC_E;
+    switch (opcode)
+    {
+        case EQ: cc = CC_E;  break;
+        case NE: cc = CC_NE; break;
+        case LT: cc = CC_L;  break;
+        case GT: cc = CC_G;  break;
+        case LE: cc = CC_LE; break;
+        case GE: cc = CC_GE; break;
+    }
+    setcc(c, cc, a.reg);
+    release(c, b);
+    push(c, a);
+}
+
+static void compileLogic(struct compiler* c, uint8_t opcode)
+{
+    if (opcode == NOT)
+    {
+        struct value a = materialize(c, pop(c));
+        test(c, a.reg, a.reg);
+        setcc(c, CC_NE, a.reg);
+        push(c, a);
+        return;
+    }
+    struct value b = materialize(c, pop(c));
+    struct value a = materialize(c, pop(c));
+    if (opcode == AND)
+    {
+        test(c, a.reg, a.reg);
+        setcc(c, CC_NE, a.reg);
+        test(c, b.reg, b.reg);
+        setcc(c, CC_NE, b.reg);
+        aluReg(c, ALU_AND, a.reg, b.reg);
+    }
+    else
+    {
+        aluReg(c, ALU_OR, a.reg, b.reg);
+        setcc(c, CC_NE, a.reg);
+    }
+    release(c, b);
+    push(c, a);
+}
+
+static void compileDup(struct compiler* c, size_t depth)
+{
+    if (depth < MAX_CACHED)
+        pull(c, depth + 1);
+    const int reg = allocate(c);
+    if (depth < (size_t) c->cached)
+    {
+        const struct value value = c->cache[c->cached - 1 - depth];
+        if (value.constant)
+        {
+            c->free |= 1 << reg;
+            push(c, value);
+            return;
+        }
+        movRegReg(c, reg, value.reg);
+    }
+    else
+        load(c, reg, RBX, 8*(c->offset - 1 - (int) (depth - c->cached)));
+    pushRegister(c, reg);
+}
+
+static void compileSwap(struct compiler* c, size_t depth)
+{
+    if (depth < MAX_CACHED)
+    {
+        pull(c, depth + 1);
+        const struct value top = c->cache[c->cached - 1];
+        c->cache[c->cached - 1] = c->cache[c->cached - 1 - depth];
+        c->cache[c->cached - 1 - depth] = top;
+        return;
+    }
+    flush(c);
+    load(c, RAX, RBX, -8);
+    load(c, RDX, RBX, -8*(int) (depth + 1));
+    store(c, RBX, -8, RDX);
+    store(c, RBX, -8*(int) (depth + 1), RAX);
+}
+
+static void compileJnz(struct compiler* c, const instruction* target)
+{
+    const struct value condition = pop(c);
+    flush(c);
+    if (condition.constant)
+    {
+        if (condition.imm == 0)
+            return;
+        if (inRegion(c, target))
+            jumpTo(c, target - c->program - c->start);
+        else
+            exitTo(c, target);
+        return;
+    }
+    test(c, condition.reg, condition.reg);
+    release(c, condition);
+    if (inRegion(c, target))
+    {
+        branchTo(c, CC_NE, target - c->program - c->start);
+        return;
+    }
+    const size_t skip = jumpForward(c, CC_E);
+    exitTo(c, target);
+    land(c, skip);
+}
+
+/*
+ * Calls function(io, arg), or function(io) if arg is negative, without
+ * writing back the cache. Neither side of vmio touches the stack, so all it
+ * takes is to keep the cache registers that are in use.
+ */
+static void callIo(struct compiler* c, void* function, int arg)
+{
+    int saved[MAX_CACHED];
+    int count = 0;
+    for (int i = 0; i < MAX_CACHED; ++i)
+        if (!(c->free & (1 << cache_registers[i])))
+            saved[count++] = cache_registers[i];
+    for (int i = 0; i < count; ++i)
+    {
+        rex(c, false, 0, saved[i], false);
+        emit8(c, 0x50 | (saved[i] & 7));
+    }
+    // sub rsp, 8 to keep it aligned for the call
+    if (count % 2)
+        aluImm(c, ALU_SUB, RSP, 8);
+    if (arg >= 0)
+        movRegReg(c, RSI, arg);
+    load(c, RDI, R12, offsetof(jit_t, io));
+    movImm(c, RAX, (uintptr_t) function);
+    // call rax
+    emit8(c, 0xFF);
+    emit8(c, 0xD0);
+    if (count % 2)
+        aluImm(c, ALU_ADD, RSP, 8);
+    for (int i = count - 1; i >= 0; --i)
+    {
+        rex(c, false, 0, saved[i], false);
+        emit8(c, 0x58 | (saved[i] & 7));
+    }
+}
+
+// vmioGetc(), with the buffer read inline
+static void compileInput(struct compiler* c)
+{
+    const int reg = allocate(c);
+    load(c, RAX, R12, offsetof(jit_t, io));
+    load(c, RDX, RAX, offsetof(vmio_t, in_pos));
+    // cmp rdx, [rax + in_length]
+    regMem(c, 0x3B, RDX, RAX, offsetof(vmio_t, in_length));
+    const size_t slow = jumpForward(c, CC_AE);
+    load(c, reg, RAX, offsetof(vmio_t, in));
+    // movzx reg32, byte [reg + rdx]
+    rex(c, false, reg, reg, false);
+    emit8(c, 0x0F);
+    emit8(c, 0xB6);
+    emit8(c, (reg & 7) << 3 | RSP);
+    emit8(c, RDX << 3 | (reg & 7));
+    aluImm(c, ALU_ADD, RDX, 1);
+    store(c, RAX, offsetof(vmio_t, in_pos), RDX);
+    const size_t done = jumpForward(c, -1);
+
+    land(c, slow);
+    callIo(c, vmioRefill, -1);
+    // movzx reg32, al, EOF becomes 255 like it does in the interpreter
+    rex(c, false, reg, RAX, false);
+    emit8(c, 0x0F);
+    emit8(c, 0xB6);
+    emit8(c, 0xC0 | (reg & 7) << 3);
+    land(c, done);
+    pushRegister(c, reg);
+}
+
+// vmioPutc(), with the buffer written inline
+static void compileOutput(struct compiler* c)
+{
+    const struct value value = materialize(c, pop(c));
+    load(c, RAX, R12, offsetof(jit_t, io));
+    load(c, RDX, RAX, offsetof(vmio_t, out_length));
+    aluImm(c, ALU_CMP, RDX, VMIO_BUFFER - 1);
+    const size_t full = jumpForward(c, CC_AE);
+    size_t newline = 0;
+    if (c->io->line_buffered)
+    {
+        // cmp reg8, '\n'
+        rex(c, false, 0, value.reg, true);
+        emit8(c, 0x80);
+        emit8(c, 0xC0 | ALU_CMP << 3 | (value.reg & 7));
+        emit8(c, '\n');
+        newline = jumpForward(c, CC_E);
+    }
+    aluImm(c, ALU_ADD, RDX, 1);
+    store(c, RAX, offsetof(vmio_t, out_length), RDX);
+    load(c, RAX, RAX, offsetof(vmio_t, out));
+    // mov [rax + rdx - 1], reg8, which needs a REX for sil and dil as well
+    if (value.reg >= RSP)
+        emit8(c, 0x40 | (value.reg >> 3) << 2);
+    emit8(c, 0x88);
+    emit8(c, 0x40 | (value.reg & 7) << 3 | RSP);
+    emit8(c, RDX << 3 | RAX);
+    emit8(c, -1);
+    const size_t done = jumpForward(c, -1);
+
+    land(c, full);
+    if (newline)
+        land(c, newline);
+    callIo(c, vmioFull, value.reg);
+    land(c, done);
+    release(c, value);
+}
+
+static bool compilable(uint8_t opcode)
+{
+    switch (opcode)
+    {
+        case JUMP: case JNZ: case DUP: case SWAP: case DROP:
+        case PUSH1: case PUSH2: case PUSH4:
+        case ADD: case SUB: case MUL: case DIV: case MOD:
+        case EQ: case NE: case LT: case GT: case LE: case GE:
+        case NOT: case AND: case OR:
+        case INPUT: case OUTPUT: case HD: case TL:
+            return true;
+#ifndef VM_COMPACT
+        // in the compact build, the interpreter stops on values that do not fit
+        case CONS:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+static void compileRecord(struct compiler* c, const instruction* record)
+{
+    switch (record->opcode)
+    {
+        case JUMP:
+            flush(c);
+            if (inRegion(c, record->target))
+                jumpTo(c, record->target - c->program - c->start);
+            else
+                exitTo(c, record->target);
+            break;
+        case JNZ:
+            compileJnz(c, record->target);
+            break;
+        case DUP:
+            compileDup(c, record->arg);
+            break;
+        case SWAP:
+            compileSwap(c, record->arg);
+            break;
+        case DROP:
+            if (c->cached > 0)
+                release(c, c->cache[--c->cached]);
+            else
+                c->offset--;
+            break;
+        case PUSH1:
+        case PUSH2:
+        case PUSH4:
+            push(c, (struct value) { .constant = true, .imm = record->arg });
+            break;
+        case ADD: case SUB: case MUL: case DIV: case MOD:
+            compileArithmetic(c, record->opcode);
+            break;
+        case EQ: case NE: case LT: case GT: case LE: case GE:
+            compileComparison(c, record->opcode);
+            break;
+        case NOT: case AND: case OR:
+            compileLogic(c, record->opcode);
+            break;
+        case INPUT:  compileInput(c);       break;
+        case OUTPUT: compileOutput(c);      break;
+        case CONS:   callOut(c, jitCons, true);  break;
+        case HD:     callOut(c, jitHd, false);   break;
+        case TL:     callOut(c, jitTl, false);   break;
+    }
+}
+
+static void compileRegion(struct compiler* c)
+{
+    const size_t length = c->end - c->start;
+    for (size_t i = c->start; i < c->end; ++i)
+    {
+        const instruction* record = &c->program[i];
+        if ((record->opcode == JUMP || record->opcode == JNZ) && inRegion(c, record->target))
+            c->is_label[record->target - c->program - c->start] = true;
+    }
+    c->free = 0;
+    for (int i = 0; i < MAX_CACHED; ++i)
+        c->free |= 1 << cache_registers[i];
+
+    // push rbx, push r12, push r13, the stack stays 16 byte aligned for calls
+    emit8(c, 0x53);
+    emit8(c, 0x41);
+    emit8(c, 0x54);
+    emit8(c, 0x41);
+    emit8(c, 0x55);
+    movRegReg(c, R12, RDI);
+    load(c, RAX, RDI, offsetof(jit_t, gc));
+    load(c, R13, RAX, offsetof(garbage_collector, machine));
+    loadTop(c);
+
+    for (size_t i = 0; i < length; ++i)
+    {
+        if (c->is_label[i])
+            flush(c);
+        c->positions[i] = c->length;
+        compileRecord(c, &c->program[c->start + i]);
+    }
+    flush(c);
+    exitTo(c, &c->program[c->end]);
+
+    // the target record is in rdx
+    c->positions[EPILOGUE] = c->length;
+    storeTop(c);
+    movRegReg(c, RAX, RDX);
+    emit8(c, 0x41);
+    emit8(c, 0x5D);
+    emit8(c, 0x41);
+    emit8(c, 0x5C);
+    emit8(c, 0x5B);
+    emit8(c, 0xC3);
+
+    if (c->failed)
+        return;
+    for (size_t i = 0; i < c->fixup_count; ++i)
+    {
+        const struct fixup* fixup = &c->fixups[i];
+        const int32_t distance = c->positions[fixup->label] - (fixup->position + 4);
+        memcpy(&c->code[fixup->position], &distance, 4);
+    }
+}
+
+/* ================================ interface ================================= */
+
+bool jitInit(jit_t* jit, instruction* program, size_t count, garbage_collector* gc,
+             vmio_t* io)
+{
+    jit->gc       = gc;
+    jit->io       = io;
+    jit->program  = program;
+    jit->count    = count;
+    jit->counters = calloc(count, sizeof(uint32_t));
+    jit->entries  = calloc(count, sizeof(jit_code));
+    jit->memory   = mmap(NULL, JIT_MEMORY, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (!jit->counters || !jit->entries || jit->memory == MAP_FAILED)
+    {
+        free(jit->counters);
+        free(jit->entries);
+        if (jit->memory != MAP_FAILED)
+            munmap(jit->memory, JIT_MEMORY);
+        jit->counters = NULL;
+        jit->entries  = NULL;
+        jit->memory   = NULL;
+        jit->enabled = false;
+        return false;
+    }
+    jit->memory_size = JIT_MEMORY;
+    jit->memory_used = 0;
+    jit->enabled     = true;
+    return true;
+}
+
+void jitDestroy(jit_t* jit)
+{
+    free(jit->counters);
+    free(jit->entries);
+    if (jit->memory)
+        munmap(jit->memory, jit->memory_size);
+    *jit = (jit_t) {0};
+}
+
+bool jitCompile(jit_t* jit, size_t index)
+{
+    struct compiler* c = calloc(1, sizeof(struct compiler));
+    if (!c)
+        return false;
+    c->program = jit->program;
+    c->io      = jit->io;
+    c->start   = index;
+    c->end     = index;
+    while (c->end < jit->count && c->end - index < MAX_REGION
+           && compilable(jit->program[c->end].opcode))
+        c->end++;
+
+    bool ok = c->end > c->start;
+    if (ok)
+    {
+        compileRegion(c);
+        ok = !c->failed && jit->memory_used + c->length <= jit->memory_size;
+    }
+    if (ok)
+    {
+        /*
+         * The memory is never writable and executable at once. Nothing runs
+         * from it while it is being written, the interpreter compiles
+         * between instructions.
+         */
+        uint8_t* code = jit->memory + jit->memory_used;
+        ok = mprotect(jit->memory, jit->memory_size, PROT_READ | PROT_WRITE) == 0;
+        if (ok)
+        {
+            memcpy(code, c->code, c->length);
+            jit->memory_used += (c->length + 15) & ~(size_t) 15;
+            ok = mprotect(jit->memory, jit->memory_size, PROT_READ | PROT_EXEC) == 0;
+        }
+        if (ok)
+            jit->entries[index] = (jit_code) code;
+    }
+    free(c->code);
+    free(c);
+    return ok;
+}
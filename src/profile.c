@@ -0,0 +1,95 @@
+#include <stdlib.h>
+
+#include "profile.h"
+#include "disasm.h"
+
+bool profileInit(profile_t* profile, const uint8_t* program, size_t length, bool cycles)
+{
+    profile->program      = program;
+    profile->length       = length;
+    profile->cycles       = cycles;
+    profile->pc_count     = calloc(length, sizeof(uint64_t));
+    profile->pc_cycles    = calloc(length, sizeof(uint64_t));
+    profile->target_count = calloc(length, sizeof(uint64_t));
+    return profile->pc_count && profile->pc_cycles && profile->target_count;
+}
+
+void profileDestroy(profile_t* profile)
+{
+    free(profile->pc_count);
+    free(profile->pc_cycles);
+    free(profile->target_count);
+}
+
+// what the comparisons below sort by, qsort() has no argument for it
+static _Thread_local const profile_t* sorting;
+
+static int byOpCount(const void* a, const void* b)
+{
+    const uint64_t x = sorting->op_count[*(const uint8_t*) a];
+    const uint64_t y = sorting->op_count[*(const uint8_t*) b];
+    return (x < y) - (x > y);
+}
+
+static int byTargetCount(const void* a, const void* b)
+{
+    const uint64_t x = sorting->target_count[*(const size_t*) a];
+    const uint64_t y = sorting->target_count[*(const size_t*) b];
+    return (x < y) - (x > y);
+}
+
+void profileReport(const profile_t* profile, FILE* out)
+{
+    char     line[64];
+    uint64_t total = 0, total_cycles = 0;
+    uint8_t  ops[256];
+    size_t   op_kinds = 0;
+    for (int op = 0; op < 256; ++op)
+    {
+        total        += profile->op_count[op];
+        total_cycles += profile->op_cycles[op];
+        if (profile->op_count[op])
+            ops[op_kinds++] = op;
+    }
+    sorting = profile;
+    qsort(ops, op_kinds, sizeof(uint8_t), byOpCount);
+
+    fprintf(out, "\n===================== OPCODES =====================\n");
+    fprintf(out, "%-8s %14s %7s %16s %10s\n", "opcode", "executed", "%", "cycles", "cyc/exec");
+    for (size_t i = 0; i < op_kinds; ++i)
+    {
+        const uint8_t  op    = ops[i];
+        const uint64_t count = profile->op_count[op];
+        const char*    name  = opcodeName(op);
+        fprintf(out, "%-8s %14lu %6.2f%% %16lu %10.1f\n", name ? name : "?", count,
+                100.0 * count / total, profile->op_cycles[op], (double) profile->op_cycles[op] / count);
+    }
+    fprintf(out, "%-8s %14lu %7s %16lu\n", "total", total, "", total_cycles);
+
+    size_t* targets = malloc(profile->length*sizeof(size_t));
+    size_t  count   = 0;
+    for (size_t i = 0; targets && i < profile->length; ++i)
+        if (profile->target_count[i])
+            targets[count++] = i;
+    if (targets)
+        qsort(targets, count, sizeof(size_t), byTargetCount);
+    fprintf(out, "\n================== JUMP TARGETS ===================\n");
+    for (size_t i = 0; i < count && i < 20; ++i)
+        fprintf(out, "%6lx %14lu\n", targets[i], profile->target_count[targets[i]]);
+    free(targets);
+
+    fprintf(out, "\n===================== LISTING =====================\n");
+    fprintf(out, "%14s %16s %8s  %6s  %s\n", "executed", "cycles", "targeted", "pc", "instruction");
+    for (size_t pc = 0; pc < profile->length; )
+    {
+        size_t size = disassemble(&profile->program[pc], line, sizeof(line));
+        if (size == 0)
+        {
+            snprintf(line, sizeof(line), "?? %02x", profile->program[pc]);
+            size = 1;
+        }
+        fprintf(out, "%14lu %16lu %8lu  %6lx  %s\n", profile->pc_count[pc], profile->pc_cycles[pc],
+                profile->target_count[pc], pc, line);
+        pc += size;
+    }
+}
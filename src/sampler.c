@@ -0,0 +1,264 @@
+// signal.h has a stack_t of its own, the one of sigaltstack()
+#define stack_t signal_stack_t
+#include <signal.h>
+#undef stack_t
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "sampler.h"
+#include "gc.h"
+#include "instructions.h"
+#include "disasm.h"
+
+// the sampler of the VM running on this thread, if any
+static __thread sampler_t* current;
+
+// how many threads have a sampler started, the timer runs while there are any
+static pthread_mutex_t  timer_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t           timer_users;
+static struct sigaction previous;
+
+static void onSample(int signal)
+{
+    (void) signal;
+    sampler_t* sampler = current;
+    if (!sampler)
+        return;
+    const instruction* ip = sampler->ip;
+    const size_t pc = ip && ip->pc < sampler->length ? ip->pc : sampler->length;
+    sampler->samples[*sampler->collecting][pc]++;
+}
+
+bool samplerInit(sampler_t* sampler, const uint8_t* program, size_t length,
+                 const instruction* code, size_t count,
+                 const volatile int* collecting, unsigned int rate)
+{
+    memset(sampler, 0, sizeof(sampler_t));
+    sampler->program    = program;
+    sampler->length     = length;
+    sampler->code       = code;
+    sampler->count      = count;
+    sampler->collecting = collecting;
+    sampler->rate       = rate ? rate : SAMPLE_RATE;
+    sampler->ip         = code;
+    for (int i = 0; i < 3; ++i)
+        if (!(sampler->samples[i] = calloc(length + 1, sizeof(uint64_t))))
+        {
+            samplerDestroy(sampler);
+            return false;
+        }
+    return true;
+}
+
+void samplerDestroy(sampler_t* sampler)
+{
+    for (int i = 0; i < 3; ++i)
+        free(sampler->samples[i]);
+    memset(sampler, 0, sizeof(sampler_t));
+}
+
+bool samplerStart(sampler_t* sampler)
+{
+    bool ok = true;
+    pthread_mutex_lock(&timer_lock);
+    if (timer_users == 0)
+    {
+        // restarted, so that a read() of the program's input does not fail with EINTR
+        struct sigaction action = { .sa_handler = onSample, .sa_flags = SA_RESTART };
+        sigemptyset(&action.sa_mask);
+        const long interval = sampler->rate < 1000000 ? 1000000 / sampler->rate : 1;
+        const struct itimerval timer = {
+            .it_interval = { interval / 1000000, interval % 1000000 },
+            .it_value    = { interval / 1000000, interval % 1000000 },
+        };
+        ok = sigaction(SIGPROF, &action, &previous) == 0
+             && setitimer(ITIMER_PROF, &timer, NULL) == 0;
+    }
+    if (ok)
+    {
+        timer_users++;
+        current = sampler;
+    }
+    pthread_mutex_unlock(&timer_lock);
+    return ok;
+}
+
+void samplerStop(void)
+{
+    pthread_mutex_lock(&timer_lock);
+    current = NULL;
+    if (--timer_users == 0)
+    {
+        const struct itimerval off = { { 0, 0 }, { 0, 0 } };
+        setitimer(ITIMER_PROF, &off, NULL);
+        sigaction(SIGPROF, &previous, NULL);
+    }
+    pthread_mutex_unlock(&timer_lock);
+}
+
+/*
+ * A loop is the code from the target of a back edge to the jump. Jumps
+ * that translateProgram() added are not in the program, and are left out.
+ */
+struct loop
+{
+    size_t start;
+    size_t end;
+};
+
+static int outermostFirst(const void* a, const void* b)
+{
+    const struct loop* x = a;
+    const struct loop* y = b;
+    if (x->start != y->start)
+        return (x->start > y->start) - (x->start < y->start);
+    return (x->end < y->end) - (x->end > y->end);
+}
+
+static size_t findLoops(const sampler_t* sampler, struct loop* loops)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < sampler->count; ++i)
+    {
+        const instruction* record = &sampler->code[i];
+        if ((record->opcode == JUMP || record->opcode == JNZ) && record->target <= record
+            && record->pc < sampler->length && record->target->pc < sampler->length)
+            loops[count++] = (struct loop) { record->target->pc, record->pc };
+    }
+    qsort(loops, count, sizeof(struct loop), outermostFirst);
+    // a loop with more than one back edge is one loop, to the last of them
+    size_t kept = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (kept && loops[kept - 1].start == loops[i].start)
+        {
+            if (loops[i].end > loops[kept - 1].end)
+                loops[kept - 1].end = loops[i].end;
+            continue;
+        }
+        loops[kept++] = loops[i];
+    }
+    return kept;
+}
+
+static void instructionAt(const sampler_t* sampler, size_t pc, char* line, size_t size)
+{
+    if (pc >= sampler->length || !disassemble(&sampler->program[pc], line, size))
+        snprintf(line, size, "%s", pc >= sampler->length ? "(end)" : "?");
+}
+
+static const char* const collections[3] = { NULL, "minor collection", "major collection" };
+
+static void writeFolded(const sampler_t* sampler, const struct loop* loops, size_t loop_count,
+                        const char* path)
+{
+    FILE* out = fopen(path, "w");
+    if (!out)
+    {
+        perror(path);
+        return;
+    }
+    char line[64];
+    for (size_t pc = 0; pc <= sampler->length; ++pc)
+        for (int kind = 0; kind < 3; ++kind)
+        {
+            const uint64_t count = sampler->samples[kind][pc];
+            if (!count)
+                continue;
+            fprintf(out, "vm");
+            for (size_t l = 0; l < loop_count; ++l)
+                if (loops[l].start <= pc && pc <= loops[l].end)
+                    fprintf(out, ";loop %lx-%lx", loops[l].start, loops[l].end);
+            instructionAt(sampler, pc, line, sizeof(line));
+            fprintf(out, ";%lx %s", pc, line);
+            if (collections[kind])
+                fprintf(out, ";%s", collections[kind]);
+            fprintf(out, " %lu\n", count);
+        }
+    fclose(out);
+}
+
+struct hot_spot
+{
+    size_t pc;
+    size_t end;
+    uint64_t samples;
+    uint64_t collecting;
+};
+
+static int bySamples(const void* a, const void* b)
+{
+    const uint64_t x = ((const struct hot_spot*) a)->samples;
+    const uint64_t y = ((const struct hot_spot*) b)->samples;
+    return (x < y) - (x > y);
+}
+
+void samplerReport(const sampler_t* sampler, const char* path, FILE* out)
+{
+    struct loop*     loops = malloc((sampler->count + 1)*sizeof(struct loop));
+    struct hot_spot* spots = malloc((sampler->length + sampler->count + 1)*sizeof(struct hot_spot));
+    if (!loops || !spots)
+    {
+        fprintf(out, "sample: out of memory for the report\n");
+        free(loops);
+        free(spots);
+        return;
+    }
+    const size_t loop_count = findLoops(sampler, loops);
+    uint64_t total = 0;
+    size_t   count = 0;
+    for (size_t pc = 0; pc <= sampler->length; ++pc)
+    {
+        const uint64_t gc  = sampler->samples[GC_MINOR][pc] + sampler->samples[GC_MAJOR][pc];
+        const uint64_t all = sampler->samples[0][pc] + gc;
+        if (all)
+            spots[count++] = (struct hot_spot) { pc, pc, all, gc };
+        total += all;
+    }
+    qsort(spots, count, sizeof(struct hot_spot), bySamples);
+
+    char line[64];
+    fprintf(out, "\n===================== SAMPLES =====================\n");
+    fprintf(out, "%lu samples at %u Hz, %.3f s of CPU time\n", total, sampler->rate,
+            (double) total / sampler->rate);
+    fprintf(out, "%6s %10s %7s %10s  %s\n", "pc", "samples", "%", "collecting", "instruction");
+    for (size_t i = 0; i < count && i < 20; ++i)
+    {
+        instructionAt(sampler, spots[i].pc, line, sizeof(line));
+        fprintf(out, "%6lx %10lu %6.2f%% %10lu  %s\n", spots[i].pc, spots[i].samples,
+                100.0 * spots[i].samples / total, spots[i].collecting, line);
+    }
+
+    // every sample in a loop counts for it, so an outer loop has its inner ones' too
+    count = 0;
+    for (size_t l = 0; l < loop_count; ++l)
+    {
+        struct hot_spot spot = { loops[l].start, loops[l].end, 0, 0 };
+        for (size_t pc = loops[l].start; pc <= loops[l].end; ++pc)
+        {
+            const uint64_t gc = sampler->samples[GC_MINOR][pc] + sampler->samples[GC_MAJOR][pc];
+            spot.samples    += sampler->samples[0][pc] + gc;
+            spot.collecting += gc;
+        }
+        if (spot.samples)
+            spots[count++] = spot;
+    }
+    qsort(spots, count, sizeof(struct hot_spot), bySamples);
+    fprintf(out, "\n====================== LOOPS ======================\n");
+    fprintf(out, "%13s %10s %7s %10s  %s\n", "pcs", "samples", "%", "collecting", "first instruction");
+    for (size_t i = 0; i < count && i < 20; ++i)
+    {
+        char range[32];
+        snprintf(range, sizeof(range), "%lx-%lx", spots[i].pc, spots[i].end);
+        instructionAt(sampler, spots[i].pc, line, sizeof(line));
+        fprintf(out, "%13s %10lu %6.2f%% %10lu  %s\n", range, spots[i].samples,
+                100.0 * spots[i].samples / total, spots[i].collecting, line);
+    }
+    if (path)
+        writeFolded(sampler, loops, loop_count, path);
+    free(loops);
+    free(spots);
+}
@@ -0,0 +1,400 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "snapshot.h"
+#include "vm.h"
+
+// older headers do not have it, and older kernels take the address as a hint
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0
+#endif
+
+// the two value encodings (see value.h) and the two cell sizes (see cons.h)
+// cannot read each other's heaps
+#if defined(VM_TAGGED) && defined(VM_COMPACT)
+#define SNAPSHOT_MAGIC   "JAVMSNTC"
+#elif defined(VM_TAGGED)
+#define SNAPSHOT_MAGIC   "JAVMSNPT"
+#elif defined(VM_COMPACT)
+#define SNAPSHOT_MAGIC   "JAVMSNPC"
+#else
+#define SNAPSHOT_MAGIC   "JAVMSNAP"
+#endif
+#define SNAPSHOT_VERSION 2
+
+struct snapshot_region
+{
+    uint64_t bottom;
+    uint64_t size;
+    // where its cells and its mark bits are in the file
+    uint64_t offset;
+    uint64_t bits;
+};
+
+struct snapshot_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t page_size;
+    uint64_t program_hash;
+    uint64_t pc;
+    uint64_t live_cells;
+    uint64_t region_count;
+    struct snapshot_region regions[MAX_REGIONS];
+    int64_t stack_top;
+    // where the stack_top entries of the stack are in the file
+    uint64_t stack;
+};
+
+// FNV-1a
+uint64_t snapshotHash(const uint8_t* bytes, size_t length)
+{
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t i = 0; i < length; ++i)
+        hash = (hash ^ bytes[i]) * 0x100000001b3;
+    return hash;
+}
+
+static size_t bitBytes(size_t region_size)
+{
+    return BitWords(region_size/sizeof(cons))*sizeof(uint64_t);
+}
+
+static bool writeAll(int fd, const void* buffer, size_t size, off_t offset)
+{
+    const uint8_t* bytes = buffer;
+    while (size)
+    {
+        const ssize_t written = pwrite(fd, bytes, size, offset);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return false;
+        bytes  += written;
+        size   -= written;
+        offset += written;
+    }
+    return true;
+}
+
+static bool readAll(int fd, void* buffer, size_t size, off_t offset)
+{
+    uint8_t* bytes = buffer;
+    while (size)
+    {
+        const ssize_t got = pread(fd, bytes, size, offset);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+        {
+            if (got == 0)
+                errno = EINVAL;
+            return false;
+        }
+        bytes  += got;
+        size   -= got;
+        offset += got;
+    }
+    return true;
+}
+
+bool snapshotWrite(const char* path, garbage_collector* gc, uint64_t program_hash,
+                   size_t pc, char* error)
+{
+    // the nursery is not part of the image, whatever is alive in it moves out
+    if (!minorCollect(gc))
+    {
+        snprintf(error, VM_ERROR_SIZE, "%s: out of memory", path);
+        return false;
+    }
+    /*
+     * A lazy collection marks and stops there, and the marks are exactly
+     * what the image needs to tell the live cells from the free ones.
+     */
+    const bool lazy = gc->lazy_sweep;
+    gc->lazy_sweep  = true;
+    markAndSweep(gc);
+    gc->lazy_sweep  = lazy;
+
+    struct snapshot_header* header = calloc(1, sizeof(struct snapshot_header));
+    const size_t page = sysconf(_SC_PAGESIZE);
+    char temporary[4096];
+    int fd = -1;
+    if (!header)
+        goto fail;
+    if (snprintf(temporary, sizeof(temporary), "%s.XXXXXX", path) >= (int) sizeof(temporary))
+    {
+        errno = ENAMETOOLONG;
+        goto fail;
+    }
+    memcpy(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic));
+    header->version      = SNAPSHOT_VERSION;
+    header->page_size    = page;
+    header->program_hash = program_hash;
+    header->pc           = pc;
+    header->live_cells   = gc->size/sizeof(cons) - gc->free_cells;
+    header->region_count = gc->region_count;
+    header->stack_top    = gc->machine->top;
+    header->stack        = sizeof(struct snapshot_header);
+
+    // the regions are whole pages, so each one starts on a page after the stack
+    const uint64_t stack_bytes = gc->machine->top*sizeof(uintptr_t);
+    uint64_t offset = (header->stack + stack_bytes + page - 1)/page*page;
+    for (size_t i = 0; i < gc->region_count; ++i)
+    {
+        header->regions[i].bottom = gc->regions[i].bottom;
+        header->regions[i].size   = gc->regions[i].size;
+        header->regions[i].offset = offset;
+        offset                   += gc->regions[i].size;
+    }
+    for (size_t i = 0; i < gc->region_count; ++i)
+    {
+        header->regions[i].bits = offset;
+        offset                 += bitBytes(gc->regions[i].size);
+    }
+
+    // written next to it and renamed, so that path is always a whole image
+    fd = mkstemp(temporary);
+    if (fd < 0 || fchmod(fd, 0644) < 0
+        || !writeAll(fd, header, sizeof(struct snapshot_header), 0)
+        || !writeAll(fd, gc->machine->data, stack_bytes, header->stack))
+        goto fail;
+    for (size_t i = 0; i < gc->region_count; ++i)
+    {
+        const heap_region* region = &gc->regions[i];
+        if (!writeAll(fd, (void*) region->bottom, region->size, header->regions[i].offset)
+            || !writeAll(fd, region->bitarray, bitBytes(region->size), header->regions[i].bits))
+            goto fail;
+    }
+    if (close(fd) < 0)
+    {
+        fd = -1;
+        goto fail;
+    }
+    fd = -1;
+    if (rename(temporary, path) < 0)
+        goto fail;
+    free(header);
+    if (!lazy)
+        sweepSome(gc, SIZE_MAX);
+    return true;
+fail:
+    snprintf(error, VM_ERROR_SIZE, "%s: %s", path, strerror(errno));
+    if (fd >= 0)
+    {
+        close(fd);
+        unlink(temporary);
+    }
+    free(header);
+    if (!lazy)
+        sweepSome(gc, SIZE_MAX);
+    return false;
+}
+
+/*
+ * Moves a heap address along with the region it points into. The old
+ * regions are in header, their new bottoms in bottoms.
+ */
+static uintptr_t relocate(const struct snapshot_header* header, const uintptr_t* bottoms,
+                          uintptr_t value)
+{
+    if (!PointsToHeap(value))
+        return value;
+    const uintptr_t address = (uintptr_t) CellOf(value);
+    for (size_t i = 0; i < header->region_count; ++i)
+        if (address - header->regions[i].bottom < header->regions[i].size)
+            return CellValue(address - header->regions[i].bottom + bottoms[i]);
+    return value;
+}
+
+// checks that the image is one this program and this machine can use
+static bool checkHeader(const struct snapshot_header* header, off_t file_size,
+                        uint64_t program_hash, const char** why)
+{
+    const size_t page = sysconf(_SC_PAGESIZE);
+    *why = "not a snapshot";
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0
+        || header->version != SNAPSHOT_VERSION)
+        return false;
+    *why = "the snapshot was taken with another program";
+    if (header->program_hash != program_hash)
+        return false;
+    *why = "the snapshot was taken with another page size";
+    if (header->page_size != page)
+        return false;
+    *why = "the snapshot is damaged";
+    if (header->region_count == 0 || header->region_count > MAX_REGIONS
+        || header->stack_top < 1 || header->stack_top > STACK_SIZE
+        || header->stack + header->stack_top*sizeof(uintptr_t) > (uint64_t) file_size)
+        return false;
+    for (size_t i = 0; i < header->region_count; ++i)
+    {
+        const struct snapshot_region* region = &header->regions[i];
+        if (region->size == 0 || region->size % page != 0 || region->offset % page != 0
+            || region->offset + region->size > (uint64_t) file_size
+            || region->bits + bitBytes(region->size) > (uint64_t) file_size)
+            return false;
+    }
+    return true;
+}
+
+bool snapshotRestore(const char* path, garbage_collector* gc, uint64_t program_hash,
+                     size_t* pc, char* error)
+{
+    struct snapshot_header* header = calloc(1, sizeof(struct snapshot_header));
+    heap_region regions[MAX_REGIONS] = {0};
+    uintptr_t* stack = NULL;
+    size_t mapped = 0;
+    const char* why = NULL;
+    struct stat st;
+    const int fd = open(path, O_RDONLY);
+    if (!header || fd < 0 || fstat(fd, &st) < 0)
+        goto fail;
+    if (st.st_size < (off_t) sizeof(struct snapshot_header))
+    {
+        why = "not a snapshot";
+        goto fail;
+    }
+    if (!readAll(fd, header, sizeof(struct snapshot_header), 0))
+        goto fail;
+    if (!checkHeader(header, st.st_size, program_hash, &why))
+        goto fail;
+    // the stack is only replaced once nothing else can fail
+    stack = malloc(header->stack_top*sizeof(uintptr_t));
+    if (!stack || !readAll(fd, stack, header->stack_top*sizeof(uintptr_t), header->stack)
+        || !stackReserve(gc->machine, header->stack_top))
+        goto fail;
+    // a sweep left over from the last run must be done with the regions replaced below
+    if (gc->sweeper)
+        gcSweepWait(gc->sweeper);
+#ifdef VM_COMPACT
+    /*
+     * The cells refer to each other by their offsets from the bottom of the
+     * first region, which is gc->base, so the regions have to be mapped at
+     * the same offsets from this heap's base. The old generation has to make
+     * room for them first (before a run, it holds nothing yet). Should the
+     * mapping fail after that, the heap starts out empty and grows again.
+     */
+    why = "the snapshot does not fit in --heap-max";
+    for (size_t i = 0; i < header->region_count; ++i)
+        if (header->regions[i].size > gc->max_size
+            || header->regions[i].bottom - header->regions[0].bottom > gc->max_size - header->regions[i].size)
+            goto fail;
+    why = NULL;
+    for (size_t i = 0; i < gc->region_count; ++i)
+        releaseRegion(&gc->regions[i]);
+    gc->region_count = 0;
+    gc->size         = 0;
+    gc->freelist     = NULL;
+    gc->free_cells   = 0;
+#endif
+
+    /*
+     * Copy on write: the pages come from the image when they are first
+     * touched, and the changes stay in this process.
+     */
+    for (; mapped < header->region_count; ++mapped)
+    {
+        const struct snapshot_region* saved = &header->regions[mapped];
+        heap_region* region = &regions[mapped];
+#ifdef VM_COMPACT
+        void* wanted = (void*) (gc->base + saved->bottom - header->regions[0].bottom);
+        void* heap   = mmap(wanted, saved->size, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_FIXED, fd, saved->offset);
+#else
+        void* wanted = (void*) saved->bottom;
+        void* heap   = mmap(wanted, saved->size, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_FIXED_NOREPLACE, fd, saved->offset);
+        if (heap == MAP_FAILED)
+            heap = mmap(NULL, saved->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, saved->offset);
+#endif
+        if (heap == MAP_FAILED)
+            goto fail;
+        region->bottom   = (uintptr_t) heap;
+        region->size     = saved->size;
+        region->bitarray = malloc(bitBytes(saved->size));
+        if (!region->bitarray || !readAll(fd, region->bitarray, bitBytes(saved->size), saved->bits))
+        {
+            mapped++;
+            goto fail;
+        }
+    }
+    close(fd);
+
+    // nothing can fail any more, the old generation is replaced
+    for (size_t i = 0; i < gc->region_count; ++i)
+        releaseRegion(&gc->regions[i]);
+    gc->region_count = header->region_count;
+    gc->size         = 0;
+    bool moved       = false;
+    uintptr_t bottoms[MAX_REGIONS];
+    for (size_t i = 0; i < gc->region_count; ++i)
+    {
+        gc->regions[i] = regions[i];
+        gc->size      += regions[i].size;
+        bottoms[i]     = regions[i].bottom;
+        moved         |= regions[i].bottom != header->regions[i].bottom;
+    }
+    if (gc->max_size < gc->size)
+        gc->max_size = gc->size;
+    memcpy(gc->machine->data, stack, header->stack_top*sizeof(uintptr_t));
+    gc->machine->top = header->stack_top;
+    free(stack);
+
+    /*
+     * Only the live (marked) cells hold values, the free ones are rebuilt
+     * by the sweep below. The head and the tail of a cell are both values,
+     * except in the compact build, where they are offsets and stay valid.
+     */
+    if (moved)
+    {
+#ifndef VM_COMPACT
+        for (size_t i = 0; i < gc->region_count; ++i)
+        {
+            const heap_region* region = &gc->regions[i];
+            const size_t words = BitWords(region->size/sizeof(cons));
+            for (size_t w = 0; w < words; ++w)
+                for (uint64_t live = region->bitarray[w]; live; live &= live - 1)
+                {
+                    cons* cell = (cons*) region->bottom + w*64 + __builtin_ctzll(live);
+                    cell->head = relocate(header, bottoms, cell->head);
+                    cell->tail = relocate(header, bottoms, cell->tail);
+                }
+        }
+#endif
+        for (int i = 0; i < gc->machine->top; ++i)
+            gc->machine->data[i] = relocate(header, bottoms, gc->machine->data[i]);
+    }
+
+    // as if a lazy collection had just marked the image
+    gc->young_ptr        = gc->nursery;
+    gc->remembered_count = 0;
+    gc->freelist         = NULL;
+    gc->free_cells       = gc->size/sizeof(cons) - header->live_cells;
+    gc->sweep_region     = 0;
+    gc->sweep_word       = 0;
+    gc->sweep_regions    = gc->region_count;
+    if (!gc->lazy_sweep)
+        sweepSome(gc, SIZE_MAX);
+    *pc = header->pc;
+    free(header);
+    return true;
+fail:
+    if (why)
+        snprintf(error, VM_ERROR_SIZE, "%s: %s", path, why);
+    else
+        snprintf(error, VM_ERROR_SIZE, "%s: %s", path, strerror(errno));
+    for (size_t i = 0; i < mapped; ++i)
+        releaseRegion(&regions[i]);
+    if (fd >= 0)
+        close(fd);
+    free(stack);
+    free(header);
+    return false;
+}
@@ -1,7 +1,104 @@
+// signal.h has a stack_t of its own, the one of sigaltstack()
+#define stack_t signal_stack_t
+#include <signal.h>
+#undef stack_t
 #include "stack.h"
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// the entries, and the guard page after them
+static size_t reservation(void)
+{
+    return STACK_SIZE*sizeof(uintptr_t) + sysconf(_SC_PAGESIZE);
+}
+
+bool stackInit(stack_t *s)
+{
+    void* data = mmap(NULL, reservation(), PROT_NONE,
+                      MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+    if (data == MAP_FAILED)
+        return false;
+    s->data      = data;
+    s->top       = 0;
+    s->committed = 0;
+    return stackReserve(s, 1);
+}
+
+void stackDestroy(stack_t *s)
+{
+    if (s->data)
+        munmap(s->data, reservation());
+    s->data = NULL;
+}
+
+bool stackReserve(stack_t *s, size_t entries)
+{
+    if (entries <= s->committed)
+        return true;
+    if (entries > STACK_SIZE)
+        return false;
+    const size_t per_chunk = STACK_CHUNK/sizeof(uintptr_t);
+    size_t committed = (entries + per_chunk - 1)/per_chunk*per_chunk;
+    if (committed > STACK_SIZE)
+        committed = STACK_SIZE;
+    if (mprotect(&s->data[s->committed], (committed - s->committed)*sizeof(uintptr_t),
+                 PROT_READ | PROT_WRITE) != 0)
+        return false;
+    s->committed = committed;
+    return true;
+}
+
+// the stack this thread runs on, see stackWatch()
+static __thread stack_t* watched;
+static __thread sigjmp_buf* watched_overflow;
+static struct sigaction previous;
+static pthread_once_t installed = PTHREAD_ONCE_INIT;
+
+static void onFault(int signal, siginfo_t* info, void* context)
+{
+    (void) signal;
+    (void) context;
+    stack_t* s = watched;
+    if (s)
+    {
+        const uintptr_t address = (uintptr_t) info->si_addr;
+        const uintptr_t bottom  = (uintptr_t) s->data;
+        const size_t    offset  = address - bottom;
+        if (address >= bottom && offset < STACK_SIZE*sizeof(uintptr_t)
+            && offset >= s->committed*sizeof(uintptr_t)
+            && stackReserve(s, offset/sizeof(uintptr_t) + 1))
+            return;
+        if (address >= bottom && offset < reservation())
+            siglongjmp(*watched_overflow, 1);
+    }
+    // not ours, so it faults again with the handler from before
+    sigaction(SIGSEGV, &previous, NULL);
+}
+
+static void install(void)
+{
+    struct sigaction action = {0};
+    action.sa_sigaction = onFault;
+    action.sa_flags     = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &previous);
+}
+
+void stackWatch(stack_t *s, sigjmp_buf *overflow)
+{
+    pthread_once(&installed, install);
+    watched          = s;
+    watched_overflow = overflow;
+}
+
+void stackUnwatch(void)
+{
+    watched = NULL;
+}
 
 // one could perform checks here to ensure the integrity of the stack.
 // but it is undefined behaviour.
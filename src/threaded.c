@@ -0,0 +1,156 @@
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "threaded.h"
+#include "instructions.h"
+#include "disasm.h"
+#include "fusion.h"
+#include "utils.h"
+#include "value.h"
+
+struct translation
+{
+    instruction* code;
+    size_t count;
+    size_t size;
+    // the record of the instruction at each offset, or -1
+    int64_t* record;
+    // offsets that still have to be decoded
+    size_t* pending;
+    size_t pending_count;
+};
+
+static instruction* emit(struct translation* t)
+{
+    if (t->count == t->size)
+    {
+        t->size = t->size ? 2*t->size : 256;
+        instruction* code = realloc(t->code, t->size*sizeof(instruction));
+        if (!code)
+            return NULL;
+        t->code = code;
+    }
+    return &t->code[t->count++];
+}
+
+/*
+ * The opcode of the first part of a superinstruction, any other opcode as
+ * is. Once its target is resolved, a wide jump is no different to a jump.
+ */
+static uint8_t partOf(uint8_t opcode)
+{
+    const superinstruction* super = superinstructionOf(opcode);
+    if (opcode == JUMP4 || opcode == JNZ4)
+        return opcode == JUMP4 ? JUMP : JNZ;
+    return super ? super->parts[0] : opcode;
+}
+
+/*
+ * The immediate of the instruction at pc. For a superinstruction, it is the
+ * immediate of its first part, the others get their own records.
+ */
+static uintptr_t immediate(const uint8_t* pc)
+{
+    switch (partOf(pc[0]))
+    {
+        case PUSH1: return IntValue(get1Byte((void*) &pc[1]));
+        case PUSH2: return IntValue(get2Byte((void*) &pc[1]));
+        case PUSH4: return IntValue(get4Byte((void*) &pc[1]));
+        case DUP:
+        case SWAP:  return pc[1]; // unsigned, unlike the pushes
+        default:    return 0;
+    }
+}
+
+// decodes one straight line run of code, starting at offset
+static bool decodeRun(struct translation* t, const uint8_t* program, size_t length,
+                      const stack_check* checks, void* const labels[256], size_t offset)
+{
+    while (offset < length && t->record[offset] < 0)
+    {
+        instruction* record = emit(t);
+        if (!record)
+            return false;
+        t->record[offset] = record - t->code;
+        if (checks && checks[offset].needed)
+        {
+            record->handler   = labels[CHECK];
+            record->pc        = offset;
+            record->opcode    = CHECK;
+            record->depth.min = checks[offset].min;
+            if (!(record = emit(t)))
+                return false;
+        }
+        const uint8_t opcode = program[offset];
+        const size_t  size   = instructionSize(opcode);
+        record->handler      = labels[opcode];
+        record->pc           = offset;
+        record->opcode       = partOf(opcode);
+        record->arg          = immediate(&program[offset]);
+        if (isJump(record->opcode))
+        {
+            // the target is filled in once every run has been decoded
+            record->arg = jumpTarget(&program[offset]);
+            t->pending[t->pending_count++] = record->arg;
+        }
+        if (record->opcode == JUMP || opcode == HALT || size == 0)
+            return true;
+        offset += size;
+    }
+    // fell through into decoded code, or off the end of the program
+    instruction* record = emit(t);
+    if (!record)
+        return false;
+    record->handler = labels[offset < length ? JUMP : HALT];
+    record->opcode  = offset < length ? JUMP : HALT;
+    record->pc      = length;
+    record->arg     = offset;
+    return true;
+}
+
+instruction* translateProgram(const uint8_t* program, size_t length,
+                              const stack_check* checks, void* const labels[256],
+                              size_t* count)
+{
+    struct translation t = {0};
+    t.record  = malloc((length + 1)*sizeof(int64_t));
+    // every instruction is at least a byte, and queues at most one target
+    t.pending = malloc((length + 1)*sizeof(size_t));
+    if (!t.record || !t.pending)
+        goto fail;
+    for (size_t i = 0; i <= length; ++i)
+        t.record[i] = -1;
+
+    t.pending[t.pending_count++] = 0;
+    for (size_t next = 0; next < t.pending_count; ++next)
+        if (t.pending[next] < length && t.record[t.pending[next]] < 0)
+            if (!decodeRun(&t, program, length, checks, labels, t.pending[next]))
+                goto fail;
+
+    // a jump past the end of the program ends up on this HALT
+    instruction* halt = emit(&t);
+    if (!halt)
+        goto fail;
+    halt->handler = labels[HALT];
+    halt->pc      = length;
+    halt->opcode  = HALT;
+    halt->arg     = 0;
+
+    for (size_t i = 0; i < t.count; ++i)
+    {
+        instruction* record = &t.code[i];
+        if (!isJump(record->opcode))
+            continue;
+        const size_t target = record->arg;
+        record->target = target < length ? &t.code[t.record[target]] : &t.code[t.count - 1];
+    }
+    free(t.record);
+    free(t.pending);
+    *count = t.count;
+    return t.code;
+fail:
+    free(t.code);
+    free(t.record);
+    free(t.pending);
+    return NULL;
+}
@@ -49,3 +49,13 @@ uintptr_t get4Byte(void *ptr)
     result &= GC_MASK;
     return result;
 }
+uintptr_t get4ByteAddress(void *ptr)
+{
+    uint8_t *address = ptr;
+    uintptr_t result = 0;
+    result |= address[0];
+    result |= (uintptr_t)address[1] << SHIFT_1_BYTE;
+    result |= (uintptr_t)address[2] << SHIFT_2_BYTE;
+    result |= (uintptr_t)address[3] << SHIFT_3_BYTE;
+    return result;
+}
@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+#include "verify.h"
+#include "instructions.h"
+#include "stack.h"
+#include "disasm.h"
+#include "utils.h"
+
+// what every valid opcode takes from the stack and leaves on it
+struct effect
+{
+    bool valid;
+    int8_t pops;
+    int8_t pushes;
+};
+
+static const struct effect effects[256] = {
+    [HALT]   = { true, 0, 0 },
+    [JUMP]   = { true, 0, 0 },
+    [JNZ]    = { true, 1, 0 },
+    [JUMP4]  = { true, 0, 0 },
+    [JNZ4]   = { true, 1, 0 },
+    [DUP]    = { true, 0, 1 }, // and it reads the entry it copies
+    [SWAP]   = { true, 0, 0 }, // likewise
+    [DROP]   = { true, 1, 0 },
+    [PUSH4]  = { true, 0, 1 },
+    [PUSH2]  = { true, 0, 1 },
+    [PUSH1]  = { true, 0, 1 },
+    [ADD]    = { true, 2, 1 },
+    [SUB]    = { true, 2, 1 },
+    [MUL]    = { true, 2, 1 },
+    [DIV]    = { true, 2, 1 },
+    [MOD]    = { true, 2, 1 },
+    [EQ]     = { true, 2, 1 },
+    [NE]     = { true, 2, 1 },
+    [LT]     = { true, 2, 1 },
+    [GT]     = { true, 2, 1 },
+    [LE]     = { true, 2, 1 },
+    [GE]     = { true, 2, 1 },
+    [NOT]    = { true, 1, 1 },
+    [AND]    = { true, 2, 1 },
+    [OR]     = { true, 2, 1 },
+    [INPUT]  = { true, 0, 1 },
+    [OUTPUT] = { true, 1, 0 },
+    [CLOCK]  = { true, 0, 0 },
+    [SNAPSHOT] = { true, 0, 0 },
+    [CONS]   = { true, 2, 1 },
+    [HD]     = { true, 1, 1 },
+    [TL]     = { true, 1, 1 },
+};
+
+#define UNREACHED (-1)
+// reached with different depths on different paths
+#define UNKNOWN   (-2)
+
+struct verifier
+{
+    const uint8_t* program;
+    size_t length;
+    // the stack depth every reached offset starts with, UNREACHED or UNKNOWN
+    int32_t* depth;
+    // whether an offset is inside (not at the start of) an instruction
+    bool* operand;
+    size_t* pending;
+    size_t pending_count;
+    stack_check* checks;
+    verify_error* error;
+};
+
+static bool fail(struct verifier* v, size_t pc, const char* format, ...)
+{
+    v->error->pc = pc;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(v->error->message, sizeof(v->error->message), format, args);
+    va_end(args);
+    return false;
+}
+
+// the instruction at from goes on to offset, with depth entries on the stack
+static bool reach(struct verifier* v, size_t from, size_t offset, int32_t depth)
+{
+    if (offset == v->length)
+        return true; // off the end, which halts
+    if (offset > v->length)
+        return fail(v, from, "jumps to %zx, past the end of the program", offset);
+    if (v->operand[offset])
+        return fail(v, from, "goes to %zx, which is inside an instruction", offset);
+    if (v->depth[offset] == depth || v->depth[offset] == UNKNOWN)
+        return true;
+    /*
+     * Every offset is queued at most twice, once when it is first reached
+     * and once when it turns out to be reached with different depths.
+     */
+    v->depth[offset] = v->depth[offset] == UNREACHED ? depth : UNKNOWN;
+    v->pending[v->pending_count++] = offset;
+    return true;
+}
+
+// the instruction at pc needs its depth checked when it runs
+static bool check(struct verifier* v, size_t pc, int32_t min)
+{
+    if (!v->checks)
+    {
+        v->checks = calloc(v->length, sizeof(stack_check));
+        if (!v->checks)
+            return fail(v, pc, "out of memory");
+    }
+    v->checks[pc] = (stack_check) { .needed = true, .min = min };
+    return true;
+}
+
+static bool step(struct verifier* v, size_t pc)
+{
+    const uint8_t opcode = v->program[pc];
+    const struct effect effect = effects[opcode];
+    if (!effect.valid)
+        return fail(v, pc, "unknown opcode %02x", opcode);
+    const size_t size = instructionSize(opcode);
+    if (pc + size > v->length)
+        return fail(v, pc, "is cut off by the end of the program");
+    for (size_t i = pc + 1; i < pc + size; ++i)
+    {
+        if (v->depth[i] != UNREACHED)
+            return fail(v, pc, "runs over %zx, which is reached as an instruction", i);
+        v->operand[i] = true;
+    }
+
+    // the entries it needs there to be, and the most it can start with
+    int32_t min = effect.pops;
+    if (opcode == DUP || opcode == SWAP)
+        min = v->program[pc + 1] + 1;
+    const int32_t max = MAX_STACK_DEPTH - effect.pushes + effect.pops;
+
+    const int32_t depth = v->depth[pc];
+    int32_t after = UNKNOWN;
+    if (depth == UNKNOWN)
+    {
+        if (!check(v, pc, min))
+            return false;
+    }
+    else
+    {
+        if (depth < min && (opcode == DUP || opcode == SWAP))
+            return fail(v, pc, "reaches entry %d of a stack of %d", min - 1, depth);
+        if (depth < min)
+            return fail(v, pc, "pops %d off a stack of %d", min, depth);
+        if (depth > max)
+            return fail(v, pc, "grows the stack past %d entries", MAX_STACK_DEPTH);
+        after = depth - effect.pops + effect.pushes;
+    }
+
+    switch (opcode)
+    {
+        case HALT:
+            return true;
+        case JUMP:
+        case JUMP4:
+            return reach(v, pc, jumpTarget(&v->program[pc]), after);
+        case JNZ:
+        case JNZ4:
+            return reach(v, pc, jumpTarget(&v->program[pc]), after)
+                && reach(v, pc, pc + size, after);
+        default:
+            return reach(v, pc, pc + size, after);
+    }
+}
+
+bool verifyProgram(const uint8_t* program, size_t length, stack_check** checks,
+                   verify_error* error)
+{
+    struct verifier v = {
+        .program = program,
+        .length  = length,
+        .depth   = malloc(length*sizeof(int32_t)),
+        .operand = calloc(length, sizeof(bool)),
+        .pending = malloc(2*length*sizeof(size_t)),
+        .error   = error,
+    };
+    bool ok = v.depth && v.operand && v.pending;
+    if (!ok)
+        fail(&v, 0, "out of memory");
+    else
+    {
+        for (size_t i = 0; i < length; ++i)
+            v.depth[i] = UNREACHED;
+        ok = reach(&v, 0, 0, 0);
+        while (ok && v.pending_count > 0)
+            ok = step(&v, v.pending[--v.pending_count]);
+    }
+    free(v.depth);
+    free(v.operand);
+    free(v.pending);
+    if (!ok)
+    {
+        free(v.checks);
+        v.checks = NULL;
+    }
+    *checks = v.checks;
+    return ok;
+}
@@ -0,0 +1,793 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "vm.h"           // this includes the public interface
+#include "instructions.h" // this includes the opcodes, labels and sizes
+#include "utils.h"        // this includes the getByte functions
+#include "stack.h"        // this includes the stack functions and stack definition
+#include "cons.h"         // this includes the cons cell definition
+#include "gc.h"           // this includes the garbage collector functions and definition
+#include "profile.h"      // this includes the counters of the profiling build
+#include "handlers.h"     // this includes the bodies of the handlers
+#include "fusion.h"       // this includes the superinstruction pass
+#include "threaded.h"     // this includes the translation to handler records
+#include "jit.h"          // this includes the native code for hot loops
+#include "verify.h"       // this includes the load time checks
+#include "disasm.h"       // this includes the disassembler, for the errors
+#include "vmio.h"         // this includes the buffered stdin and stdout
+#include "snapshot.h"     // this includes the warm start images
+#include "heapprof.h"     // this includes the allocation sites of the profiling build
+#include "sampler.h"      // this includes the SIGPROF profiler
+
+struct vm_program
+{
+    // as loaded, fusion rewrites it in place
+    uint8_t* bytes;
+    size_t length;
+    // the size of its mapping, or 0 if it was allocated
+    size_t mapped;
+    stack_check* checks;
+    // the translated program (see threaded.h)
+    instruction* code;
+    size_t count;
+    // false if the native code would skip its checks
+    bool jit;
+    // of the bytes as loaded, before fusion, see snapshot.h
+    uint64_t hash;
+};
+
+struct vm
+{
+    vm_options options;
+    vm_program* program;
+    // vm_load() programs go with the VM, vm_attach() ones are only borrowed
+    bool owns_program;
+    // where the next vm_run() starts, if not at the beginning (see vm_restore())
+    instruction* resume;
+
+    stack_t stack;
+    garbage_collector gc;
+    jit_t jit;
+    vmio_t io;
+    // only ever started with the sample option
+    sampler_t sampler;
+#ifdef VM_PROFILE
+    profile_t profile;
+    heap_profile_t heap_profile;
+#endif
+    char error[VM_ERROR_SIZE];
+};
+
+static void fail(char* error, const char* format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void fail(char* error, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vsnprintf(error, VM_ERROR_SIZE, format, args);
+    va_end(args);
+}
+
+// kept out of vm_run(), whose sigsetjmp() would make the loop keep its locals in memory
+static vm_status interpret(vm_t* vm, void* const** labels_out) __attribute__((noinline));
+
+vm_options vm_default_options(void)
+{
+    return (vm_options) {
+        .heap_size      = 10*4096,
+        .max_heap_size  = 1UL << 30,
+        .nursery_size   = 8*4096,
+        .grow_threshold = 0.5,
+        .sample_rate    = SAMPLE_RATE,
+        .gc_threads     = 1,
+        .fuse           = true,
+        .jit            = true,
+        .in_fd          = STDIN_FILENO,
+        .out_fd         = STDOUT_FILENO,
+    };
+}
+
+vm_t* vm_create(const vm_options* options)
+{
+    if (options->heap_size == 0 || options->nursery_size == 0
+        || options->max_heap_size < options->heap_size)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    vm_t* vm = calloc(1, sizeof(vm_t));
+    if (!vm)
+        return NULL;
+    vm->options    = *options;
+    vm->gc.machine = &vm->stack;
+    if (!stackInit(&vm->stack))
+        goto fail;
+
+    // every item on the heap is a cons cell
+    if (!gcInit(&vm->gc, options->heap_size, options->max_heap_size,
+                options->nursery_size, options->grow_threshold))
+        goto fail;
+    vm->gc.lazy_sweep = options->lazy_sweep;
+    if (options->gc_stats || options->gc_stats_json)
+        vm->gc.stats = gcStatsCreate();
+    if (options->gc_threads > 1
+        && !(vm->gc.markers = gcMarkersCreate(&vm->gc, options->gc_threads)))
+        goto fail;
+    if (options->concurrent_sweep && !options->lazy_sweep
+        && !(vm->gc.sweeper = gcSweeperCreate(&vm->gc)))
+        goto fail;
+    if (!vmioInit(&vm->io, options->in_fd, options->out_fd, options->line_buffered))
+        goto fail;
+    return vm;
+fail:
+    {
+        const int saved = errno;
+        vm_destroy(vm);
+        errno = saved;
+        return NULL;
+    }
+}
+
+/*
+ * The program is mapped rather than read, so that loading a big image costs
+ * nothing until its pages are touched. The mapping is private, which lets
+ * fusion rewrite opcodes without it ever reaching the file. It is followed
+ * by at least a page of zeroes (the tail of its last page, and one anonymous
+ * page), so that decoding an instruction cut off by the end of the program
+ * never faults. Anything that cannot be mapped, like a pipe, is read instead.
+ */
+static bool readProgram(vm_program* program, const char* path, char* error)
+{
+    const int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0)
+        goto fail;
+    const size_t page = sysconf(_SC_PAGESIZE);
+    size_t size = 0;
+    if (S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        size = st.st_size;
+        const size_t reserved = (size + page - 1)/page*page + page;
+        uint8_t* bytes = mmap(NULL, reserved, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (bytes == MAP_FAILED)
+            goto fail;
+        program->bytes  = bytes;
+        program->mapped = reserved;
+        if (mmap(bytes, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+            goto fail;
+    }
+    else
+    {
+        size_t capacity = 0;
+        ssize_t got;
+        do {
+            if (capacity - size < page)
+            {
+                capacity = capacity ? 2*capacity : 16*page;
+                uint8_t* bytes = realloc(program->bytes, capacity + page);
+                if (!bytes)
+                    goto fail;
+                program->bytes = bytes;
+            }
+            got = read(fd, program->bytes + size, capacity - size);
+            if (got < 0)
+                goto fail;
+            size += got;
+        } while (got > 0);
+        memset(program->bytes + size, 0, capacity + page - size);
+    }
+    close(fd);
+    program->length = size;
+    if (size == 0)
+    {
+        fail(error, "%s: the program is empty", path);
+        return false;
+    }
+    return true;
+fail:
+    fail(error, "%s: %s", path, strerror(errno));
+    if (fd >= 0)
+        close(fd);
+    return false;
+}
+
+// everything that happens to a program between loading it and running it
+static bool prepareProgram(vm_program* program, const vm_options* options,
+                           const char* name, char* error)
+{
+    /*
+     * Nothing checks anything while the program runs, so whatever could go
+     * wrong has to be ruled out here.
+     */
+    verify_error rejected;
+    if (!verifyProgram(program->bytes, program->length, &program->checks, &rejected))
+    {
+        char instruction[64];
+        disassemble(&program->bytes[rejected.pc], instruction, sizeof(instruction));
+        fail(error, "%s: rejected at %zx: %s%s%s", name, rejected.pc,
+             instruction, instruction[0] ? " " : "", rejected.message);
+        return false;
+    }
+    bool fuse    = options->fuse;
+    program->jit = true;
+    if (program->checks)
+    {
+        if (options->strict)
+        {
+            fail(error, "%s: rejected, the stack depth cannot be proven", name);
+            return false;
+        }
+        /*
+         * The checks go between the records, where superinstructions expect
+         * their parts, and the native code would skip them.
+         */
+        fuse         = false;
+        program->jit = false;
+    }
+
+    program->hash = snapshotHash(program->bytes, program->length);
+    if (fuse)
+        fuseSuperinstructions(program->bytes, program->length);
+
+    // the records point at handlers, which only the interpreter knows
+    void* const* labels;
+    interpret(NULL, &labels);
+    program->code = translateProgram(program->bytes, program->length, program->checks,
+                                     labels, &program->count);
+    if (!program->code)
+    {
+        fail(error, "%s: could not translate the program", name);
+        return false;
+    }
+    return true;
+}
+
+vm_program* vm_program_load(const char* path, const vm_options* options, char* error)
+{
+    vm_program* program = calloc(1, sizeof(vm_program));
+    if (!program)
+    {
+        fail(error, "%s: %s", path, strerror(errno));
+        return NULL;
+    }
+    if (!readProgram(program, path, error) || !prepareProgram(program, options, path, error))
+    {
+        vm_program_destroy(program);
+        return NULL;
+    }
+    return program;
+}
+
+vm_program* vm_program_load_bytes(const uint8_t* bytes, size_t length,
+                                  const vm_options* options, char* error)
+{
+    if (length == 0)
+    {
+        fail(error, "the program is empty");
+        return NULL;
+    }
+    vm_program* program = calloc(1, sizeof(vm_program));
+    // with zeroes after it, like a mapped one
+    const size_t padding = sysconf(_SC_PAGESIZE);
+    if (program)
+        program->bytes = calloc(length + padding, 1);
+    if (!program || !program->bytes)
+    {
+        fail(error, "%s", strerror(errno));
+        vm_program_destroy(program);
+        return NULL;
+    }
+    memcpy(program->bytes, bytes, length);
+    program->length = length;
+    if (!prepareProgram(program, options, "program", error))
+    {
+        vm_program_destroy(program);
+        return NULL;
+    }
+    return program;
+}
+
+void vm_program_destroy(vm_program* program)
+{
+    if (!program)
+        return;
+    free(program->code);
+    free(program->checks);
+    if (program->mapped)
+        munmap(program->bytes, program->mapped);
+    else
+        free(program->bytes);
+    free(program);
+}
+
+// lets go of the program, and of everything that only makes sense with it
+static void detach(vm_t* vm)
+{
+    jitDestroy(&vm->jit);
+    samplerDestroy(&vm->sampler);
+#ifdef VM_PROFILE
+    profileDestroy(&vm->profile);
+    memset(&vm->profile, 0, sizeof(vm->profile));
+    vm->gc.heap_profile = NULL;
+    heapProfileDestroy(&vm->heap_profile);
+#endif
+    if (vm->owns_program)
+        vm_program_destroy(vm->program);
+    vm->program      = NULL;
+    vm->owns_program = false;
+    vm->resume       = NULL;
+}
+
+bool vm_attach(vm_t* vm, vm_program* program)
+{
+    if (vm->program == program)
+        return true;
+    detach(vm);
+    vm->program = program;
+    bool jit    = vm->options.jit && program->jit;
+    if (vm->options.sample
+        && !samplerInit(&vm->sampler, program->bytes, program->length, program->code,
+                        program->count, &vm->gc.collecting, vm->options.sample_rate))
+    {
+        fail(vm->error, "sample: %s", strerror(errno));
+        vm->program = NULL;
+        return false;
+    }
+#ifdef VM_PROFILE
+    if (!profileInit(&vm->profile, program->bytes, program->length, vm->options.profile_cycles))
+    {
+        fail(vm->error, "profile: %s", strerror(errno));
+        vm->program = NULL;
+        return false;
+    }
+    if (vm->options.heap_profile)
+    {
+        if (!heapProfileInit(&vm->heap_profile, &vm->gc, program->bytes, program->length,
+                             vm->options.heap_profile, vm->options.heap_graph))
+        {
+            fail(vm->error, "%s: %s", vm->options.heap_profile, strerror(errno));
+            profileDestroy(&vm->profile);
+            memset(&vm->profile, 0, sizeof(vm->profile));
+            vm->program = NULL;
+            return false;
+        }
+        vm->gc.heap_profile = &vm->heap_profile;
+    }
+    // the counters would miss everything that runs natively
+    jit = false;
+#endif
+#ifdef VM_TAGGED
+    // the native code knows the default value encoding only
+    jit = false;
+#endif
+    // the JIT is only ever an optimization, without it everything is interpreted
+    if (jit)
+        jitInit(&vm->jit, program->code, program->count, &vm->gc, &vm->io);
+    return true;
+}
+
+bool vm_load(vm_t* vm, const char* path)
+{
+    vm_program* program = vm_program_load(path, &vm->options, vm->error);
+    if (!program || !vm_attach(vm, program))
+    {
+        vm_program_destroy(program);
+        return false;
+    }
+    vm->owns_program = true;
+    return true;
+}
+
+bool vm_load_bytes(vm_t* vm, const uint8_t* bytes, size_t length)
+{
+    vm_program* program = vm_program_load_bytes(bytes, length, &vm->options, vm->error);
+    if (!program || !vm_attach(vm, program))
+    {
+        vm_program_destroy(program);
+        return false;
+    }
+    vm->owns_program = true;
+    return true;
+}
+
+bool vm_set_io(vm_t* vm, int in_fd, int out_fd)
+{
+    if (!vmioReopen(&vm->io, in_fd, out_fd))
+    {
+        fail(vm->error, "%s", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+/*
+ * The record that runs the instruction at pc. It always exists, since pc
+ * follows a SNAPSHOT, which is never part of a superinstruction. The one at
+ * the end of the program is the HALT after the last record (the jumps out of
+ * a run of code also claim that pc, see threaded.c).
+ */
+static instruction* recordAt(const vm_program* program, size_t pc)
+{
+    if (pc >= program->length)
+        return &program->code[program->count - 1];
+    for (size_t i = 0; i < program->count; ++i)
+        if (program->code[i].pc == pc)
+            return &program->code[i];
+    return NULL;
+}
+
+bool vm_restore(vm_t* vm, const char* path)
+{
+    if (!vm->program)
+    {
+        fail(vm->error, "%s: there is no program to restore", path);
+        return false;
+    }
+    size_t pc;
+    if (!snapshotRestore(path, &vm->gc, vm->program->hash, &pc, vm->error))
+        return false;
+    vm->resume = recordAt(vm->program, pc);
+    if (!vm->resume)
+    {
+        fail(vm->error, "%s: the snapshot resumes at %zx, which is not an instruction", path, pc);
+        return false;
+    }
+    return true;
+}
+
+// the statistics are written after every run, however it ended
+static void reportGcStats(vm_t* vm)
+{
+    const size_t allocated = (vm->gc.young_ptr - vm->gc.nursery)*sizeof(cons);
+    if (vm->options.gc_stats)
+        gcStatsReport(vm->gc.stats, allocated, vm->gc.size, vm->options.gc_stats);
+    if (vm->options.gc_stats_json)
+    {
+        FILE* out = fopen(vm->options.gc_stats_json, "w");
+        if (!out)
+        {
+            perror(vm->options.gc_stats_json);
+            return;
+        }
+        gcStatsJson(vm->gc.stats, allocated, vm->gc.size, out);
+        fclose(out);
+    }
+}
+
+vm_status vm_run(vm_t* vm)
+{
+    vm->error[0] = '\0';
+    // the stack grows as it is pushed to, and this is where it lands when it cannot
+    sigjmp_buf overflow;
+    vm_status  status;
+    // a sampler that cannot start only means no samples
+    const bool sampling = vm->options.sample && samplerStart(&vm->sampler);
+    if (sigsetjmp(overflow, 1) == 0)
+    {
+        stackWatch(&vm->stack, &overflow);
+        status = interpret(vm, NULL);
+    }
+    else
+    {
+        fail(vm->error, "stack overflow, past %d entries", STACK_SIZE);
+        status = VM_STACK_ERROR;
+    }
+    stackUnwatch();
+    if (sampling)
+        samplerStop();
+    vmioFlush(&vm->io);
+    if (vm->gc.stats)
+        reportGcStats(vm);
+    if (vm->options.sample)
+        samplerReport(&vm->sampler, vm->options.sample, stderr);
+#ifdef VM_PROFILE
+    if (vm->gc.heap_profile)
+        heapProfileReport(vm->gc.heap_profile, &vm->gc);
+    profileReport(&vm->profile, stderr);
+#endif
+    return status;
+}
+
+const char* vm_error(const vm_t* vm)
+{
+    return vm->error;
+}
+
+void vm_destroy(vm_t* vm)
+{
+    if (!vm)
+        return;
+    detach(vm);
+    vmioDestroy(&vm->io);
+    gcDestroy(&vm->gc);
+    stackDestroy(&vm->stack);
+    free(vm);
+}
+
+/*
+ * The interpreter loop. Called with labels_out, it only hands out its table
+ * of handlers (see threaded.h) and returns.
+ */
+static vm_status interpret(vm_t* vm, void* const** labels_out)
+{
+    /*
+     * The superinstructions take some of the unused opcodes, so they are
+     * filled in over the default entry.
+     */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Woverride-init"
+    static void* const labels[256] = { // the indices must match the opcodes
+        /*index 0*/&&L_HALT,
+        /*index 1*/&&L_JUMP, 
+        /*index 2*/&&L_JNZ, 
+        /*index 3*/&&L_DUP, 
+        /*index 4*/&&L_SWAP, 
+        /*index 5*/&&L_DROP,
+        /*index 6*/&&L_PUSH4,
+        /*index 7*/&&L_PUSH2,
+        /*index 8*/&&L_PUSH1,
+        /*index 9*/&&L_ADD,
+        /*index 10*/&&L_SUB,
+        /*index 11*/&&L_MUL,
+        /*index 12*/&&L_DIV,
+        /*index 13*/&&L_MOD,
+        /*index 14*/&&L_EQ,
+        /*index 15*/&&L_NE,
+        /*index 16*/&&L_LT,
+        /*index 17*/&&L_GT,
+        /*index 18*/&&L_LE,
+        /*index 19*/&&L_GE,
+        /*index 20*/&&L_NOT,
+        /*index 21*/&&L_AND,
+        /*index 22*/&&L_OR,
+        /*index 23*/&&L_INPUT,
+        /*index 24*/&&L_OUTPUT,
+        /*index 25*/&&L_JUMP,  // JUMP4, the records have the target already
+        /*index 26*/&&L_JNZ,   // JNZ4, likewise
+        /*index 27*/&&L_DEFAULT,
+        /*index 28*/&&L_DEFAULT,
+        /*index 29*/&&L_DEFAULT,
+        /*index 30*/&&L_DEFAULT,
+        /*index 31*/&&L_DEFAULT,
+        /*index 32*/&&L_DEFAULT,
+        /*index 33*/&&L_DEFAULT,
+        /*index 34*/&&L_DEFAULT,
+        /*index 35*/&&L_DEFAULT,
+        /*index 36*/&&L_DEFAULT,
+        /*index 37*/&&L_DEFAULT,
+        /*index 38*/&&L_DEFAULT,
+        /*index 39*/&&L_DEFAULT,
+        /*index 40*/&&L_DEFAULT,
+        /*index 41*/&&L_DEFAULT,
+        /*index 42*/&&L_CLOCK,
+        /*index 43*/&&L_SNAPSHOT,
+        /*index 44*/&&L_DEFAULT,
+        /*index 45*/&&L_DEFAULT,
+        /*index 46*/&&L_DEFAULT,
+        /*index 47*/&&L_DEFAULT,
+        /*index 48*/&&L_CONS,
+        /*index 49*/&&L_HD,
+        /*index 50*/&&L_TL,
+        [51 ... 255] = &&L_DEFAULT,
+#define SUPER2(name, opcode, a, b)    [opcode] = &&L_##name,
+#define SUPER3(name, opcode, a, b, c) [opcode] = &&L_##name,
+#include "superinstructions.h"
+#undef SUPER2
+#undef SUPER3
+        [CHECK] = &&L_CHECK,
+    };
+#pragma GCC diagnostic pop
+
+    if (labels_out)
+    {
+        *labels_out = labels;
+        return VM_HALTED;
+    }
+
+    uint8_t   char_input  = 0, char_output = 0;
+    uintptr_t arg1        = 0, arg2        = 0;
+    cons      *poppedCell = NULL;
+
+    clock_t begin     = clock();
+    clock_t end       = clock();
+    double time_spent = 0.0;
+
+    instruction* ip = vm->program->code;
+
+    /*
+     * The stack starts with the slot the (missing) top of an empty stack is
+     * cached from, see handlers.h. A restored one has it already.
+     */
+    if (vm->resume)
+    {
+        ip         = vm->resume;
+        vm->resume = NULL;
+    }
+    else
+    {
+        vm->stack.data[0] = 0;
+        vm->stack.top     = 1;
+    }
+    uintptr_t* sp;
+    uintptr_t  tos;
+    RELOAD_STACK();
+    vm->sampler.ip = ip;
+    DISPATCH();
+
+L_JUMP:
+    PROFILE_INSTRUCTION(&vm->profile, ip);
+    DO_JUMP();
+    DISPATCH();
+L_JNZ:
+    PROFILE_INSTRUCTION(&vm->profile, ip);
+    DO_JNZ();
+    DISPATCH();
+L_DUP:
+    PROFILE_INSTRUCTION(&vm->profile, ip);
+    DO_DUP();
+    DISPATCH();
+L_SWAP:
+    PROFILE_INSTRUCTION(&vm->profile, ip);
+    DO_SWAP();
+    DISPATCH();
+L_DROP:
+    PROFILE_INSTRUCTION(&vm->profile, ip);
+    DO_DROP();
+    DISPATCH();
+    /* ==================PUSH OPERATORS===================== */
+L_PUSH1:
+    PROFILE_INSTRUCTION(&vm->profile, ip);
+    DO_PUSH1();
+    DISPATCH();
+L_PUSH2:
+    PROFILE_INSTRUCTION(&vm->profile, ip);
+    DO_PUSH2();
+    DISPATCH();
+L_PUSH4:
+    PROFILE_INSTRUCTION(&vm->profile, ip);
+    DO_PUSH4();
+    DISPATCH();
+    /* ==================ARITHMETIC OPERATORS===================== */
+    /*
+     * operators are 31 or 63 bit.
+     * (depending on the machine.)
+     * 1 bit has to be retained for
+     * garbage collection purposes.
+     */
+L_ADD:
+    PROFILE_INSTRUCTION(&vm->profile, ip);
+    DO_ADD();
+    DISPATCH();
+L_SUB:
+    PROFILE_INSTRUCTION(&vm->profile, ip);
+    DO_SUB();
+    DISPATCH();
+L_MUL:
+    PROFILE_INSTRUCTION(&vm->profile, ip);
+    DO_MUL();
+    DISPATCH();
+L_DIV:
+    PROFILE_INSTRUCTION(&vm->profile, ip);
+    DO_DIV();
+    DISPATCH();
+L_MOD:
+    PROFILE_INSTRUCTION(&vm->profile, ip);
+    DO_MOD();
+    DISPATCH();
+    /* =========================COMPARISONS======================= */
+    /*
+     * the bytes that have been pushed on the stack are signed.
+     * therefore, eventhough an unsigned type is used to represent
+     * the data on the stack, the comparison operators must operate
+     * on signed types. Therefore, the data are casted to signed
+     * types before the comparison.
+    */
+L_EQ:
+    PROFILE_INSTRUCTION(&vm->profile, ip);
+    DO_EQ();
+    DISPATCH();
+L_NE:
+    PROFILE_INSTRUCTION(&vm->profile, ip);
+    DO_NE();
+    DISPATCH();
+L_LT:
+    PROFILE_INSTRUCTION(&vm->profile, ip);
+    DO_LT();
+    DISPATCH();
+L_GT:
+    PROFILE_INSTRUCTION(&vm->profile, ip);
+    DO_GT();
+    DISPATCH();
+L_LE:
+    PROFILE_INSTRUCTION(&vm->profile, ip);
+    DO_LE();
+    DISPATCH();
+L_GE:
+    PROFILE_INSTRUCTION(&vm->profile, ip);
+    DO_GE();
+    DISPATCH();
+    /* ======================LOGICAL OPERATORS==================== */
+L_NOT:
+    PROFILE_INSTRUCTION(&vm->profile, ip);
+    DO_NOT();
+    DISPATCH();
+L_AND:
+    PROFILE_INSTRUCTION(&vm->profile, ip);
+    DO_AND();
+    DISPATCH();
+L_OR:
+    PROFILE_INSTRUCTION(&vm->profile, ip);
+    DO_OR();
+    DISPATCH();
+    /* ==================vm->io OPERATORS===================== */
+L_INPUT:
+    PROFILE_INSTRUCTION(&vm->profile, ip);
+    DO_INPUT();
+    DISPATCH();
+L_OUTPUT:
+    PROFILE_INSTRUCTION(&vm->profile, ip);
+    DO_OUTPUT();
+    DISPATCH();
+    /* ======================DYNAMIC MEMORY======================= */
+L_CONS:
+    PROFILE_INSTRUCTION(&vm->profile, ip);
+    DO_CONS();
+    DISPATCH();
+L_HD:
+    PROFILE_INSTRUCTION(&vm->profile, ip);
+    DO_HD();
+    DISPATCH();
+L_TL:
+    PROFILE_INSTRUCTION(&vm->profile, ip);
+    DO_TL();
+    DISPATCH();
+    /* ===========================FINISH========================== */
+L_CLOCK:
+    PROFILE_INSTRUCTION(&vm->profile, ip);
+    DO_CLOCK();
+    DISPATCH();
+L_SNAPSHOT:
+    PROFILE_INSTRUCTION(&vm->profile, ip);
+    DO_SNAPSHOT();
+    DISPATCH();
+L_HALT:
+    PROFILE_INSTRUCTION(&vm->profile, ip);
+    SYNC_STACK();
+    vmioPrintf(&vm->io, "Halting.\n");
+    return VM_HALTED;
+L_DEFAULT:
+    vmioPrintf(&vm->io, "either end of stream or wrong opcode\n");
+    return VM_BAD_OPCODE;
+L_CHECK:
+    DO_CHECK();
+    DISPATCH();
+    /* ======================SUPERINSTRUCTIONS==================== */
+#define SUPER2(name, opcode, a, b)                                              \
+L_##name:                                                                       \
+    PROFILE_INSTRUCTION(&vm->profile, ip);                                          \
+    DO_##a();                                                                   \
+    DO_##b();                                                                   \
+    DISPATCH();
+#define SUPER3(name, opcode, a, b, c)                                           \
+L_##name:                                                                       \
+    PROFILE_INSTRUCTION(&vm->profile, ip);                                          \
+    DO_##a();                                                                   \
+    DO_##b();                                                                   \
+    DO_##c();                                                                   \
+    DISPATCH();
+#include "superinstructions.h"
+#undef SUPER2
+#undef SUPER3
+}
@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "vmio.h"
+
+// maps the rest of in_fd, if it is a regular file
+static bool mapInput(vmio_t* io)
+{
+    struct stat st;
+    if (fstat(io->in_fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+        return false;
+    const off_t offset = lseek(io->in_fd, 0, SEEK_CUR);
+    if (offset < 0 || offset >= st.st_size)
+        return false;
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, io->in_fd, 0);
+    if (data == MAP_FAILED)
+        return false;
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    io->in        = data;
+    io->in_pos    = offset;
+    io->in_length = st.st_size;
+    io->in_mapped = true;
+    return true;
+}
+
+bool vmioInit(vmio_t* io, int in_fd, int out_fd, bool line_buffered)
+{
+    *io = (vmio_t) { .line_buffered = line_buffered };
+    io->out = malloc(VMIO_BUFFER);
+    if (!io->out)
+        return false;
+    return vmioReopen(io, in_fd, out_fd);
+}
+
+bool vmioReopen(vmio_t* io, int in_fd, int out_fd)
+{
+    vmioFlush(io);
+    if (io->in_mapped)
+        munmap((void*) io->in, io->in_length);
+    io->in_fd     = in_fd;
+    io->out_fd    = out_fd;
+    io->in_pos    = 0;
+    io->in_length = 0;
+    io->in_mapped = false;
+    io->in_eof    = false;
+    if (mapInput(io))
+        return true;
+    if (!io->in_buffer && !(io->in_buffer = malloc(VMIO_BUFFER)))
+        return false;
+    io->in = io->in_buffer;
+    return true;
+}
+
+void vmioFlush(vmio_t* io)
+{
+    size_t written = 0;
+    while (written < io->out_length)
+    {
+        const ssize_t n = write(io->out_fd, io->out + written, io->out_length - written);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            // like stdio, the output is lost and the program goes on
+            perror("write");
+            break;
+        }
+        written += n;
+    }
+    io->out_length = 0;
+}
+
+void vmioDestroy(vmio_t* io)
+{
+    if (io->out)
+        vmioFlush(io);
+    free(io->out);
+    free(io->in_buffer);
+    if (io->in_mapped)
+        munmap((void*) io->in, io->in_length);
+    io->out = io->in_buffer = NULL;
+    io->in_mapped = false;
+}
+
+int vmioRefill(vmio_t* io)
+{
+    if (io->in_mapped || io->in_eof)
+        return EOF;
+    // the program may be waiting on an answer to what it just printed
+    vmioFlush(io);
+    ssize_t n;
+    do
+        n = read(io->in_fd, io->in_buffer, VMIO_BUFFER);
+    while (n < 0 && errno == EINTR);
+    if (n <= 0)
+    {
+        io->in_eof = true;
+        return EOF;
+    }
+    io->in_pos    = 1;
+    io->in_length = n;
+    return io->in[0];
+}
+
+void vmioFull(vmio_t* io, uint8_t c)
+{
+    io->out[io->out_length++] = c;
+    vmioFlush(io);
+}
+
+void vmioPrintf(vmio_t* io, const char* format, ...)
+{
+    char line[256];
+    va_list args;
+    va_start(args, format);
+    const int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    for (int i = 0; i < length && i < (int) sizeof(line) - 1; ++i)
+        vmioPutc(io, line[i]);
+}
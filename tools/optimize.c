@@ -0,0 +1,461 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "instructions.h"
+#include "disasm.h"
+#include "verify.h"
+#include "utils.h"
+
+/*
+ * An offline optimizer for bytecode files:
+ *
+ *     tools/optimize program.bin optimized.bin
+ *
+ * The program is decoded into a list of nodes, rewritten until nothing
+ * changes any more, and laid out again with every jump pointing at the new
+ * address of its target. The rewrites are
+ *   - PUSH a; PUSH b; op    the arithmetic, comparisons and logic on two
+ *                           constants, and PUSH a; NOT, become one PUSH
+ *   - PUSH a; DROP          and DUP n; DROP, are removed
+ *   - PUSH a; JNZ l         becomes JUMP l, or nothing if a is 0
+ *   - a jump to a JUMP      goes to where that one goes, a JUMP to a HALT
+ *                           halts, and a jump to the next instruction is
+ *                           removed (a JNZ becomes a DROP)
+ *   - whatever cannot be reached from the start is removed
+ * A pattern is only rewritten if nothing jumps into its middle. Every PUSH
+ * gets the smallest encoding of its value, and every jump the 2 byte one
+ * unless its target is past the first 64 KB.
+ *
+ * The result has the same effect on the stack at every instruction, so it
+ * passes the verifier whenever the input does (it is checked anyway).
+ */
+
+// JUMP4 and JNZ4 become JUMP and JNZ, and every push PUSH4, until the layout
+struct node
+{
+    uint8_t opcode;
+    // the value a push pushes (masked, as the VM sees it), or the operand of DUP and SWAP
+    uintptr_t value;
+    // the node a jump goes to, count for the end of the program
+    size_t target;
+    size_t offset;
+    // something jumps here
+    bool label;
+    bool dead;
+    bool wide;
+};
+
+struct program
+{
+    struct node* nodes;
+    size_t count;
+};
+
+static uint8_t* readFile(const char* path, size_t* length)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file)
+        return NULL;
+    fseek(file, 0, SEEK_END);
+    const long size = ftell(file);
+    rewind(file);
+    // the zeroes past the end keep a cut off instruction from reading further
+    uint8_t* bytes = calloc(size + 8, 1);
+    if (!bytes || fread(bytes, 1, size, file) != (size_t) size)
+    {
+        free(bytes);
+        bytes = NULL;
+    }
+    fclose(file);
+    *length = size;
+    return bytes;
+}
+
+// every instruction gets a node, the unreachable ones are dropped later
+static struct program decode(const uint8_t* bytes, size_t length)
+{
+    struct program program = { calloc(length + 1, sizeof(struct node)), 0 };
+    size_t* index = calloc(length + 1, sizeof(size_t));
+    if (!program.nodes || !index)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for (size_t pc = 0; pc < length; pc += instructionSize(bytes[pc]))
+    {
+        struct node* node = &program.nodes[program.count];
+        index[pc]    = program.count++;
+        node->opcode = bytes[pc];
+        node->offset = pc;
+        switch (bytes[pc])
+        {
+            case PUSH1: node->value  = get1Byte((void*) &bytes[pc + 1]) & GC_MASK; break;
+            case PUSH2: node->value  = get2Byte((void*) &bytes[pc + 1]) & GC_MASK; break;
+            case PUSH4: node->value  = get4Byte((void*) &bytes[pc + 1]) & GC_MASK; break;
+            case DUP:
+            case SWAP:  node->value  = bytes[pc + 1]; break;
+            case JUMP4: node->opcode = JUMP; break;
+            case JNZ4:  node->opcode = JNZ; break;
+            default: break;
+        }
+        if (bytes[pc] == PUSH1 || bytes[pc] == PUSH2)
+            node->opcode = PUSH4;
+    }
+    index[length] = program.count;
+    // the verifier made sure that every target is the start of an instruction
+    for (size_t i = 0; i < program.count; ++i)
+        if (isJump(program.nodes[i].opcode))
+            program.nodes[i].target = index[jumpTarget(&bytes[program.nodes[i].offset])];
+    free(index);
+    return program;
+}
+
+static bool endsFlow(uint8_t opcode)
+{
+    return opcode == JUMP || opcode == HALT;
+}
+
+/*
+ * Marks what can be reached from the start as alive (and the targets of
+ * jumps as labels), everything else as dead.
+ */
+static void findReachable(struct program* program)
+{
+    struct node* nodes = program->nodes;
+    size_t* pending    = malloc((program->count + 1)*sizeof(size_t));
+    size_t count       = 0;
+    for (size_t i = 0; i < program->count; ++i)
+    {
+        nodes[i].dead  = true;
+        nodes[i].label = false;
+    }
+    if (program->count)
+    {
+        nodes[0].dead    = false;
+        pending[count++] = 0;
+    }
+    while (count)
+    {
+        const size_t i = pending[--count];
+        size_t next[2];
+        size_t successors = 0;
+        if (!endsFlow(nodes[i].opcode))
+            next[successors++] = i + 1;
+        if (isJump(nodes[i].opcode))
+        {
+            next[successors++] = nodes[i].target;
+            if (nodes[i].target < program->count)
+                nodes[nodes[i].target].label = true;
+        }
+        for (size_t s = 0; s < successors; ++s)
+            if (next[s] < program->count && nodes[next[s]].dead)
+            {
+                nodes[next[s]].dead = false;
+                pending[count++]    = next[s];
+            }
+    }
+    free(pending);
+}
+
+// drops the dead nodes, a jump to one goes to the next live one instead
+static void compact(struct program* program)
+{
+    struct node* nodes = program->nodes;
+    // the new index of every live node, which for a dead one is the next live one's
+    size_t* moved = malloc((program->count + 1)*sizeof(size_t));
+    size_t kept   = 0;
+    for (size_t i = 0; i < program->count; ++i)
+    {
+        moved[i] = kept;
+        if (!nodes[i].dead)
+            nodes[kept++] = nodes[i];
+    }
+    moved[program->count] = kept;
+    for (size_t i = 0; i < kept; ++i)
+        if (isJump(nodes[i].opcode))
+            nodes[i].target = moved[nodes[i].target];
+    program->count = kept;
+    free(moved);
+}
+
+// the value a push decodes to is sign extended from its operand and masked
+static intptr_t signedValue(uintptr_t value)
+{
+    return (intptr_t) (value << 1) >> 1;
+}
+
+/*
+ * The value of PUSH a; PUSH b; opcode, as the handlers in handlers.h work it
+ * out with the default value encoding. The tagged one (see value.h) divides
+ * signed and stops on overflow, where this wraps around, so a division is
+ * only folded where the two agree, on operands that are not negative.
+ */
+static bool fold(uint8_t opcode, uintptr_t a, uintptr_t b, uintptr_t* result)
+{
+    if ((opcode == DIV || opcode == MOD) && (signedValue(a) < 0 || signedValue(b) < 0))
+        return false;
+    switch (opcode)
+    {
+        case ADD: *result = (a + b) & GC_MASK; return true;
+        case SUB: *result = (a - b) & GC_MASK; return true;
+        case MUL: *result = (a * b) & GC_MASK; return true;
+        // a division by zero is left for the program to crash on
+        case DIV: if (b == 0) return false; *result = (a / b) & GC_MASK; return true;
+        case MOD: if (b == 0) return false; *result = (a % b) & GC_MASK; return true;
+        case EQ:  *result = a == b; return true;
+        case NE:  *result = a != b; return true;
+        case LT:  *result = (intptr_t) (a << 1) <  (intptr_t) (b << 1); return true;
+        case GT:  *result = (intptr_t) (a << 1) >  (intptr_t) (b << 1); return true;
+        case LE:  *result = (intptr_t) (a << 1) <= (intptr_t) (b << 1); return true;
+        case GE:  *result = (intptr_t) (a << 1) >= (intptr_t) (b << 1); return true;
+        case AND: *result = a != 0 && b != 0; return true;
+        case OR:  *result = a != 0 || b != 0; return true;
+        default:  return false;
+    }
+}
+
+static bool encodable(uintptr_t value)
+{
+    const intptr_t v = signedValue(value);
+    return v >= INT32_MIN && v <= INT32_MAX;
+}
+
+// one round of rewrites, returns whether anything changed
+static bool rewrite(struct program* program)
+{
+    struct node* nodes = program->nodes;
+    const size_t count = program->count;
+    bool changed = false;
+    for (size_t i = 0; i < count; ++i)
+    {
+        struct node* node = &nodes[i];
+        if (node->dead)
+            continue;
+        // only the first node of a pattern may be jumped to
+        struct node* next  = i + 1 < count && !nodes[i + 1].label && !nodes[i + 1].dead ? &nodes[i + 1] : NULL;
+        struct node* third = next && i + 2 < count && !nodes[i + 2].label && !nodes[i + 2].dead ? &nodes[i + 2] : NULL;
+        uintptr_t result;
+
+        if (node->opcode == PUSH4 && next && next->opcode == PUSH4 && third
+            && fold(third->opcode, node->value, next->value, &result) && encodable(result))
+        {
+            node->value = result;
+            next->dead  = third->dead = true;
+            changed     = true;
+        }
+        else if (node->opcode == PUSH4 && next && next->opcode == NOT)
+        {
+            node->value = node->value != 0;
+            next->dead  = true;
+            changed     = true;
+        }
+        else if ((node->opcode == PUSH4 || node->opcode == DUP) && next && next->opcode == DROP)
+        {
+            node->dead = next->dead = true;
+            changed    = true;
+        }
+        else if (node->opcode == PUSH4 && next && next->opcode == JNZ)
+        {
+            // the JNZ keeps the place of the pair, in case something jumps to the PUSH
+            next->label = node->label;
+            node->dead  = true;
+            if (node->value != 0)
+                next->opcode = JUMP;
+            else
+                next->dead = true;
+            changed = true;
+        }
+        else if (isJump(node->opcode))
+        {
+            // a chain of JUMPs may be a loop, so it is followed only so far
+            size_t target = node->target;
+            for (size_t hops = 0; target < count && nodes[target].opcode == JUMP && hops < count; ++hops)
+                target = nodes[target].target;
+            if (target != node->target)
+            {
+                node->target = target;
+                changed      = true;
+            }
+            if (node->target == i + 1)
+            {
+                // it goes where it would have gone anyway
+                if (node->opcode == JUMP)
+                    node->dead = true;
+                else
+                    node->opcode = DROP;
+                changed = true;
+            }
+            else if (node->opcode == JUMP && target < count && nodes[target].opcode == HALT)
+            {
+                node->opcode = HALT;
+                changed      = true;
+            }
+        }
+    }
+    return changed;
+}
+
+static size_t pushSize(uintptr_t value)
+{
+    const intptr_t v = signedValue(value);
+    if (v >= INT8_MIN && v <= INT8_MAX)
+        return SIZEOF_PUSH1;
+    if (v >= INT16_MIN && v <= INT16_MAX)
+        return SIZEOF_PUSH2;
+    return SIZEOF_PUSH4;
+}
+
+static size_t nodeSize(const struct node* node)
+{
+    switch (node->opcode)
+    {
+        case PUSH4: return pushSize(node->value);
+        case JUMP:  return node->wide ? SIZEOF_JUMP4 : SIZEOF_JUMP;
+        case JNZ:   return node->wide ? SIZEOF_JNZ4 : SIZEOF_JNZ;
+        default:    return instructionSize(node->opcode);
+    }
+}
+
+/*
+ * Gives every node its new offset, and returns the length of the program.
+ * A jump only gets wider, and only if its target is too far for 2 bytes,
+ * so this ends.
+ */
+static size_t layout(struct program* program)
+{
+    struct node* nodes = program->nodes;
+    for (;;)
+    {
+        size_t offset = 0;
+        for (size_t i = 0; i < program->count; ++i)
+        {
+            nodes[i].offset = offset;
+            offset         += nodeSize(&nodes[i]);
+        }
+        bool widened = false;
+        for (size_t i = 0; i < program->count; ++i)
+        {
+            if (isJump(nodes[i].opcode) && !nodes[i].wide)
+            {
+                const size_t address = nodes[i].target < program->count
+                                       ? nodes[nodes[i].target].offset : offset;
+                if (address > 0xFFFF)
+                    nodes[i].wide = widened = true;
+            }
+        }
+        if (!widened)
+            return offset;
+    }
+}
+
+static void putBytes(uint8_t* out, uintptr_t value, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+        out[i] = (value >> (8*i)) & 0xFF;
+}
+
+static uint8_t* emit(const struct program* program, size_t length)
+{
+    const struct node* nodes = program->nodes;
+    uint8_t* bytes = calloc(length + 8, 1);
+    if (!bytes)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < program->count; ++i)
+    {
+        const struct node* node = &nodes[i];
+        uint8_t* out = &bytes[node->offset];
+        const size_t size = nodeSize(node);
+        out[0] = node->opcode;
+        switch (node->opcode)
+        {
+            case PUSH4:
+                out[0] = size == SIZEOF_PUSH1 ? PUSH1 : size == SIZEOF_PUSH2 ? PUSH2 : PUSH4;
+                putBytes(&out[1], signedValue(node->value), size - 1);
+                break;
+            case JUMP:
+            case JNZ:
+                if (node->wide)
+                    out[0] = node->opcode == JUMP ? JUMP4 : JNZ4;
+                putBytes(&out[1], node->target < program->count ? nodes[node->target].offset : length,
+                         size - 1);
+                break;
+            case DUP:
+            case SWAP:
+                out[1] = node->value;
+                break;
+            default:
+                break;
+        }
+    }
+    return bytes;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "Usage: %s <bytecodefile> <output>\n", argv[0]);
+        exit(1);
+    }
+    size_t length;
+    uint8_t* bytes = readFile(argv[1], &length);
+    if (!bytes)
+    {
+        fprintf(stderr, "Error: Could not read file %s\n", argv[1]);
+        exit(1);
+    }
+
+    // what the VM would refuse to run is not worth optimizing
+    stack_check* checks = NULL;
+    verify_error error;
+    if (length == 0 || !verifyProgram(bytes, length, &checks, &error))
+    {
+        fprintf(stderr, "%s: rejected at %zx: %s\n", argv[1], length ? error.pc : 0,
+                length ? error.message : "the program is empty");
+        exit(1);
+    }
+    free(checks);
+
+    struct program program = decode(bytes, length);
+    const size_t instructions = program.count;
+    bool changed = true;
+    while (changed)
+    {
+        // what the last round removed goes first, then what it left unreachable
+        compact(&program);
+        findReachable(&program);
+        compact(&program);
+        // which also finds the labels of what is left
+        findReachable(&program);
+        changed = rewrite(&program);
+    }
+
+    const size_t optimized_length = layout(&program);
+    uint8_t* optimized = emit(&program, optimized_length);
+    checks = NULL;
+    if (optimized_length == 0 || !verifyProgram(optimized, optimized_length, &checks, &error))
+    {
+        fprintf(stderr, "%s: the optimized program does not verify, this is a bug\n", argv[1]);
+        exit(1);
+    }
+    free(checks);
+
+    FILE* out = fopen(argv[2], "wb");
+    if (!out || fwrite(optimized, 1, optimized_length, out) != optimized_length || fclose(out) != 0)
+    {
+        fprintf(stderr, "Error: Could not write file %s\n", argv[2]);
+        exit(1);
+    }
+    fprintf(stderr, "%s: %zu -> %zu bytes, %zu -> %zu instructions\n", argv[1],
+            length, optimized_length, instructions, program.count);
+    free(optimized);
+    free(program.nodes);
+    free(bytes);
+    return 0;
+}